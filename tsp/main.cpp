@@ -1,64 +1,192 @@
 #include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <cstdio>
+#include <csignal>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include "tsp.h"
 using namespace std;
 
 /**
- * Main function that is run on startup.
- * @param  argc number of command line parameters, should be 1 for testing, 0 for kattis
- * @param  argv the command line parameters, number between 1 and 7 for different algorithms, m for default
- *                  1 - Closest neighbour
- *                  2 - Closest neighbour and two opt with neighbour list
- *                  3 - Closest neighbour and simulated annealing
- *                  4 - Closest neighbour and two opt with neighbour list and simulated annealing
- *                  5 - Shortest edge
- *                  6 - Shortest edge and two opt with neighbour list
- *                  7 - Shortest edge and simulated annealing
- *                  8 - Shortest edge and two opt with neighbour list and simulated annealing
- *                  9 - Shortest edge and two opt with neighbour list and simulated annealing or closest neighbour and picking best
- * @return      0
+ * Parameters for one run of the pipeline.
  */
-int main(int argc, char *argv[]) {
-    // Default algorithm
-    int algorithm = 6;
+struct Tuning {
+    // Largest n the entry is used for
+    int max_n;
+    // Whether the entry is for clustered instances
+    bool clustered;
+    // Construction: 0 closest neighbour, 1 shortest edge, 2 savings, 3 multilevel
+    int construction;
+    // Neighbour list size, and iterations for 2-opt, 0 iterations to skip
+    int m;
+    int two_opt_iter;
+    // Iterations for annealing with neighbour list moves, 0 to skip
+    int annealing_iter;
+};
+
+/**
+ * Tuning table from sweep.py, which runs every combination of construction, m, 2-opt
+ * and annealing budget on three uniform and three clustered instances of each size.
+ * For every size and kind, the settings that take at most a second on average are
+ * ranked by their total tour length, and the fastest within 0.2% of the shortest is
+ * kept, with its mean time in the comment. Instances with at most 20 points are solved
+ * exactly and never get here.
+ */
+static const Tuning tuning_table[] = {
+    //   max_n  clustered  construction  m   two_opt   annealing
+    {     100, false,     3,             5,   100000,          0 },  // 0.01 s
+    {     100, true,      3,            10,   100000,          0 },  // 0.01 s
+    {     400, false,     1,            10,   100000,    1000000 },  // 0.23 s
+    {     400, true,      3,            10,        0,    1000000 },  // 0.28 s
+    {    2000, false,     1,             5,     1000,    1000000 },  // 0.61 s
+    {    2000, true,      3,            40,        0,    1000000 },  // 0.65 s
+    { 1 << 30, false,     3,             5,        0,          0 },  // 0.97 s
+    { 1 << 30, true,      3,            20,        0,          0 },  // 0.68 s
+};
 
-    // Read algorithm from command line
-    if (argc == 2) {
-        algorithm = (int) (*argv[1] == 'm' ? algorithm : *argv[1]) - 48;
+/**
+ * Picks the tuning for an instance from its features.
+ * @param  f the features of the instance
+ * @return   the tuning to use
+ */
+Tuning auto_configure(const Features & f) {
+    bool clustered = f.clustering > 0.5;
+    for (const Tuning & t : tuning_table) {
+        if (f.n <= t.max_n && t.clustered == clustered) {
+            Tuning result = t;
+            // If all points are on top of each other there is nothing to improve
+            if (f.spread == 0) {
+                result.two_opt_iter = 0;
+                result.annealing_iter = 0;
+            }
+            return result;
+        }
     }
+    return tuning_table[0];
+}
 
-    // Create the TSP problem
-    TSP tsp;
+/**
+ * Options from the command line.
+ */
+struct Options {
+    // Algorithm to run, see main
+    int algorithm = 6;
+    // Whether to pick the pipeline automatically
+    bool automatic = false;
+    // Gap to the lower bound at which to stop improving, negative for never
+    double gap = -1;
+    // Whether to order neighbour lists by alpha-nearness
+    bool alpha = false;
+    // Whether to print the gap to the lower bound
+    bool print_gap = false;
+    // Whether to use the tuning below instead of the table in automatic mode
+    bool tuned = false;
+    Tuning tuning;
+};
 
-    // Create space to read to
+/**
+ * Reads an instance: first how many coordinates there are, and then the coordinates.
+ * The TSP is cleared first, which keeps its buffers for reuse.
+ * @param  in  the stream to read from
+ * @param  tsp the problem to read into
+ * @return     false at the end of the stream
+ */
+bool read_instance(FILE* in, TSP& tsp) {
     int n;
-    double x, y;
+    if (fscanf(in, "%d", &n) != 1) {
+        return false;
+    }
+    tsp.clear();
 
-    // Read first how many coordinates we should read, and then read and add them
-    cin >> n;
+    double x, y;
     for (int i = 0; i < n; ++i) {
-    	cin >> x;
-    	cin >> y;
-    	tsp.add_point(x, y);
+        if (fscanf(in, "%lf %lf", &x, &y) != 2) {
+            return false;
+        }
+        tsp.add_point(x, y);
     }
     tsp.heal_list();
+    return true;
+}
+
+/**
+ * Solves the instance with the algorithm from the options.
+ * @param  tsp     the problem, with the points added
+ * @param  options the options
+ * @return         a lower bound on the tour length, 0 if it was not needed
+ */
+double solve(TSP& tsp, const Options& options) {
+    int n = tsp.size();
+    int algorithm = options.algorithm;
+    bool need_bound = options.gap >= 0 || options.alpha || options.print_gap;
 
     // Special cases for small n, which makes us being able to skip
     // taking care of these in other parts of the program.
-    switch (n) {
-        case 0:
-            exit(0);
-        case 1:
-            cout << "0" << endl;
-            exit(0);
-        case 2:
-            cout << "0" << endl;
-            cout << "1" << endl;
-            exit(0);
-        case 3:
-            cout << "0" << endl;
-            cout << "1" << endl;
-            cout << "2" << endl;
-            exit(0);
+    // The points are already linked in order, which is optimal in one of the directions.
+    if (n <= 3) {
+        tsp.orient_tour();
+        return need_bound ? tsp.total_dist() : 0;
+    }
+
+    // Lower bound for the optimality gap, also lets the improving algorithms stop early.
+    // It is only computed when asked for, and with fewer iterations for large instances,
+    // where each one costs more and the bound has to leave time for the gap target to matter.
+    double bound = 0;
+    if (need_bound) {
+        bound = tsp.lower_bound(max(100, min(1000, 300000 / n)), 10);
+    }
+    if (options.gap >= 0) {
+        tsp.set_gap_target(bound, options.gap);
+    }
+    tsp.set_alpha_nearness(options.alpha);
+
+    // Small instances are solved exactly, branch and bound is usually much faster
+    // than the dynamic program but can blow up on clustered instances
+    bool exact = false;
+    if (n <= 16) {
+        tsp.exec_held_karp();
+        exact = true;
+    } else if (n <= 20) {
+        tsp.exec_naive();
+        if (!tsp.improve_branch_and_bound(50000)) {
+            tsp.exec_held_karp();
+        }
+        exact = true;
+    }
+
+    if (options.automatic && !exact) {
+        Features f = tsp.features(100);
+        Tuning t = options.tuned ? options.tuning : auto_configure(f);
+        tsp.log("Spridning: " + to_string(f.spread) + ", klustring: " + to_string(f.clustering));
+
+        switch (t.construction) {
+            case 1:
+                tsp.exec_shortest_edge();
+                break;
+            case 2:
+                tsp.exec_savings(t.m);
+                break;
+            case 3:
+                tsp.exec_multilevel(t.m);
+                break;
+            default:
+                tsp.exec_naive();
+                break;
+        }
+        if (t.two_opt_iter > 0) {
+            tsp.improve_two_opt_neighbour(t.two_opt_iter, t.m);
+        }
+        if (t.annealing_iter > 0) {
+            tsp.improve_v2_simulated_annealing(t.annealing_iter, t.m);
+        }
+    }
+    if (options.automatic || exact) {
+        algorithm = 0;
     }
 
     // Chose algorithm to run
@@ -95,7 +223,7 @@ int main(int argc, char *argv[]) {
             tsp.improve_two_opt_neighbour(10000, 300);
             tsp.improve_simulated_annealing(4000);
             break;
-        case 9:
+        case 9: {
             tsp.exec_naive();
             int dist1 = tsp.total_dist();
 
@@ -108,13 +236,255 @@ int main(int argc, char *argv[]) {
                 tsp.exec_naive();
             }
             break;
+        }
+        case 10:
+            tsp.exec_shortest_edge();
+            tsp.improve_two_opt_neighbour(10000, 40);
+            tsp.improve_recombination(8, 400, 12);
+            break;
+        case 11:
+            tsp.exec_shortest_edge();
+            tsp.improve_two_opt_neighbour(10000, 40);
+            tsp.improve_parallel_tempering(0, 1000000, 12);
+            break;
+        case 12:
+            tsp.exec_savings(10);
+            break;
+        case 13:
+            tsp.exec_savings(10);
+            tsp.improve_two_opt_neighbour(10000, 300);
+            break;
+        case 14:
+            tsp.exec_multilevel(10);
+            break;
+        case 15:
+            tsp.exec_shortest_edge();
+            tsp.improve_two_opt_neighbour(10000, 300);
+            tsp.improve_v2_simulated_annealing(20 * n + 1000000, 10);
+            break;
+        case 16:
+            tsp.exec_multilevel(10);
+            tsp.improve_v2_simulated_annealing(20 * n + 1000000, 10);
+            break;
+    }
+
+    // Constructions do not care about direction, an asymmetric tour may be shorter backwards
+    tsp.orient_tour();
+
+    return bound;
+}
+
+/**
+ * Solves a stream of instances with a pool of workers. Every worker has one TSP from the
+ * pool and reuses its buffers from instance to instance. The workers take turns reading the next
+ * instance, and each result is written as soon as it is done: a line "# i" where i is
+ * the position of the instance in the stream, followed by the tour. No gaps are printed,
+ * so the lower bound is only computed when -g or -alpha needs it. If a tour cannot be
+ * written, the reader is gone and the stream ends.
+ * @param in      the stream to read instances from
+ * @param out     the stream to write tours to
+ * @param options the options
+ * @param pool    one TSP for each worker thread
+ */
+void solve_stream(FILE* in, FILE* out, const Options& options, vector<TSP>& pool) {
+    mutex input, output;
+    int next_id = 0;
+    atomic<bool> closed(false);
+    Options stream_options = options;
+    stream_options.print_gap = false;
+
+    auto work = [&](TSP& tsp) {
+        tsp.set_verbose(false);
+        ostringstream result;
+
+        while (!closed) {
+            int id;
+            {
+                lock_guard<mutex> lock(input);
+                if (closed || !read_instance(in, tsp)) break;
+                id = next_id++;
+            }
+
+            solve(tsp, stream_options);
+
+            result.str("");
+            result << "# " << id << '\n';
+            tsp.print_result(result);
+            string text = result.str();
+
+            lock_guard<mutex> lock(output);
+            if (fwrite(text.data(), 1, text.size(), out) != text.size() || fflush(out) != 0) {
+                closed = true;
+            }
+        }
+    };
+
+    vector<thread> threads;
+    for (TSP& tsp : pool) {
+        threads.push_back(thread(work, ref(tsp)));
+    }
+    for (thread & th : threads) {
+        th.join();
+    }
+}
+
+/**
+ * Listens on a local socket and solves the instances sent on each connection, one
+ * connection at a time. A client writes its instances, shuts down its writing side
+ * and reads the tours in the same format as from solve_stream. The workers keep their
+ * TSP from connection to connection, so the buffers are reused across clients too.
+ * @param  path    the path of the socket
+ * @param  options the options
+ * @param  workers number of worker threads
+ * @return         1 if the socket could not be set up
+ */
+int serve(const char* path, const Options& options, int workers) {
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+    unlink(path);
+    if (server < 0 || ::bind(server, (sockaddr*) &address, sizeof(address)) < 0 || listen(server, 16) < 0) {
+        cerr << "Kunde inte lyssna på " << path << endl;
+        return 1;
     }
 
+    // A client that disconnects early must only end its own stream
+    signal(SIGPIPE, SIG_IGN);
+
+    vector<TSP> pool(workers);
+    while (true) {
+        int client = accept(server, nullptr, nullptr);
+        if (client < 0) continue;
+        FILE* in = fdopen(client, "r");
+        FILE* out = fdopen(dup(client), "w");
+        solve_stream(in, out, options, pool);
+        fclose(in);
+        fclose(out);
+    }
+}
+
+/**
+ * Main function that is run on startup.
+ * @param  argc number of command line parameters, should be 1 for testing, 0 for kattis
+ * @param  argv the command line parameters, number between 1 and 16 for different algorithms, m for default
+ *                  1 - Closest neighbour
+ *                  2 - Closest neighbour and two opt with neighbour list
+ *                  3 - Closest neighbour and simulated annealing
+ *                  4 - Closest neighbour and two opt with neighbour list and simulated annealing
+ *                  5 - Shortest edge
+ *                  6 - Shortest edge and two opt with neighbour list
+ *                  7 - Shortest edge and simulated annealing
+ *                  8 - Shortest edge and two opt with neighbour list and simulated annealing
+ *                  9 - Shortest edge and two opt with neighbour list and simulated annealing or closest neighbour and picking best
+ *                 10 - Shortest edge and two opt with neighbour list and recombination
+ *                 11 - Shortest edge and two opt with neighbour list and parallel tempering on all cores
+ *                 12 - Savings
+ *                 13 - Savings and two opt with neighbour list
+ *                 14 - Multilevel coarsening with 2-opt and Or-opt refinement
+ *                 15 - Shortest edge and two opt with neighbour list and annealing with neighbour list moves
+ *                 16 - Multilevel and annealing with neighbour list moves
+ *                  a - Automatic, picks the pipeline and its parameters from features of the instance
+ *              the algorithm may be left out when the options come first, anything else is an error
+ *              instances with at most 20 points are always solved exactly
+ *              further parameters are options, or a binary distance matrix file to read instead of coordinates
+ *                  -g gap  - stop improving once the tour is within gap (e.g. 0.01) of the lower bound
+ *                  -alpha  - order neighbour lists by alpha-nearness instead of distance
+ *                  -lb     - print the gap to the lower bound after the final distance
+ *                  -t c,m,k,a - automatic mode with construction c, neighbours m, k 2-opt and a annealing
+ *                               iterations instead of the tuning table, used by sweep.py
+ *                  -b      - batch mode, solve every instance on stdin and print each tour after "# i"
+ *                  -s path - server mode, like batch mode but for each connection to a local socket
+ *                  -j n    - number of worker threads in batch and server mode, default one per core
+ * @return      0, or 1 on bad parameters or if the matrix or socket could not be opened
+ */
+int main(int argc, char *argv[]) {
+    Options options;
+
+    // Read algorithm from command line, options may follow directly with the default
+    int first = 1;
+    if (argc >= 2 && *argv[1] != '-') {
+        first = 2;
+        string arg = argv[1];
+        if (arg == "a") {
+            options.automatic = true;
+        } else if (arg != "m") {
+            char* end;
+            long algorithm = strtol(argv[1], &end, 10);
+            if (*end != '\0' || algorithm < 1 || algorithm > 16) {
+                cerr << "Okänd algoritm " << arg << endl;
+                return 1;
+            }
+            options.algorithm = algorithm;
+        }
+    }
+
+    // Read options and the distance matrix file
+    const char* matrix_file = nullptr;
+    const char* socket_path = nullptr;
+    bool batch = false;
+    int workers = max(1, (int) thread::hardware_concurrency());
+    for (int i = first; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-g" && i + 1 < argc) {
+            options.gap = atof(argv[++i]);
+        } else if (arg == "-alpha") {
+            options.alpha = true;
+        } else if (arg == "-lb") {
+            options.print_gap = true;
+        } else if (arg == "-t" && i + 1 < argc) {
+            Tuning& t = options.tuning;
+            if (sscanf(argv[++i], "%d,%d,%d,%d", &t.construction, &t.m, &t.two_opt_iter, &t.annealing_iter) != 4) {
+                cerr << "Felaktig inställning " << argv[i] << endl;
+                return 1;
+            }
+            options.automatic = true;
+            options.tuned = true;
+        } else if (arg == "-b") {
+            batch = true;
+        } else if (arg == "-s" && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (arg == "-j" && i + 1 < argc) {
+            workers = max(1, atoi(argv[++i]));
+        } else {
+            matrix_file = argv[i];
+        }
+    }
+
+    if (socket_path != nullptr) {
+        return serve(socket_path, options, workers);
+    }
+    if (batch) {
+        vector<TSP> pool(workers);
+        solve_stream(stdin, stdout, options, pool);
+        return 0;
+    }
+
+    // Create the TSP problem
+    TSP tsp;
+
+    if (matrix_file != nullptr) {
+        // Map the distance matrix instead of reading coordinates
+        if (!tsp.load_distance_matrix(matrix_file)) {
+            return 1;
+        }
+        tsp.heal_list();
+    } else if (!read_instance(stdin, tsp)) {
+        return 0;
+    }
+
+    double bound = solve(tsp, options);
+
     // Print the result
     tsp.print_result();
 
-    // Log the final distance
-    cerr << "Final distance: " << tsp.total_dist() << endl;
+    // Log the final distance and how far it is from the lower bound
+    int distance = tsp.total_dist();
+    cerr << "Final distance: " << distance;
+    if (bound > 0) {
+        cerr << " (gap " << max(0.0, 100 * (distance - bound) / bound) << "%)";
+    }
+    cerr << endl;
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""
+Offline sweep for the tuning table in main.cpp. Runs ./tsp -t with every combination
+of construction, m, 2-opt and annealing budget on generated uniform and clustered
+instances, and prints one table row for each size and kind: the fastest setting within
+0.2% of the shortest total tour among those that take at most a second on average.
+The fixed pipelines are run as well, for comparison.
+
+    g++ -O2 -std=c++11 -pthread main.cpp tsp.cpp -o tsp && ./sweep.py
+"""
+import itertools
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import time
+
+SIZES = [(50, 100), (200, 400), (1000, 2000), (5000, 1 << 30)]
+SEEDS = [1, 2, 3]
+BUDGET = 1.0
+TOLERANCE = 0.002
+
+CONSTRUCTIONS = [0, 1, 2, 3]
+NEIGHBOURS = [5, 10, 20, 40]
+TWO_OPT = [0, 1000, 100000]
+ANNEALING = [0, 100000, 1000000, 10000000]
+PIPELINES = range(1, 17)
+
+
+def instance(n, clustered, seed):
+    """Points in a square of side 10^6, around n/50 centres if clustered."""
+    rng = random.Random(seed)
+    lines = [str(n)]
+    centres = [(rng.uniform(0, 1e6), rng.uniform(0, 1e6)) for _ in range(max(2, n // 50))]
+    for _ in range(n):
+        if clustered:
+            x, y = rng.choice(centres)
+            lines.append("%f %f" % (rng.gauss(x, 1e4), rng.gauss(y, 1e4)))
+        else:
+            lines.append("%f %f" % (rng.uniform(0, 1e6), rng.uniform(0, 1e6)))
+    return "\n".join(lines) + "\n"
+
+
+def run(args, path):
+    """Length of the tour and the time taken, None if it takes far too long."""
+    start = time.time()
+    try:
+        with open(path) as f:
+            done = subprocess.run(["./tsp"] + args, stdin=f, stdout=subprocess.DEVNULL,
+                                  stderr=subprocess.PIPE, text=True, timeout=4 * BUDGET)
+    except subprocess.TimeoutExpired:
+        return None
+    elapsed = time.time() - start
+    for line in done.stderr.splitlines():
+        if line.startswith("Final distance:"):
+            return int(line.split()[2]), elapsed
+    return None
+
+
+def measure(args, paths):
+    """Total length and mean time over the instances, None if over the budget."""
+    total, elapsed = 0, 0
+    for path in paths:
+        result = run(args, path)
+        if result is None or result[1] > 2 * BUDGET:
+            return None
+        total += result[0]
+        elapsed += result[1]
+    elapsed /= len(paths)
+    return (total, elapsed) if elapsed <= BUDGET else None
+
+
+def main():
+    directory = tempfile.mkdtemp()
+    for (n, max_n), clustered in itertools.product(SIZES, [False, True]):
+        paths = []
+        for seed in SEEDS:
+            path = os.path.join(directory, "%d_%d_%d.txt" % (n, clustered, seed))
+            with open(path, "w") as f:
+                f.write(instance(n, clustered, seed))
+            paths.append(path)
+
+        results = {}
+        for setting in itertools.product(CONSTRUCTIONS, NEIGHBOURS, TWO_OPT, ANNEALING):
+            if setting[1] < n:
+                results[setting] = measure(["a", "-t", ",".join(map(str, setting))], paths)
+        results = {s: r for s, r in results.items() if r is not None}
+        shortest = min(r[0] for r in results.values())
+        best = min((s for s, r in results.items() if r[0] <= shortest * (1 + TOLERANCE)),
+                   key=lambda s: results[s][1])
+
+        for pipeline in PIPELINES:
+            result = measure([str(pipeline)], paths)
+            if result is not None:
+                print("    // pipeline %2d: %+.2f%% in %.2f s" % (pipeline, 100.0 * (result[0] / shortest - 1), result[1]),
+                      file=sys.stderr)
+        row = (max_n if max_n < 1 << 30 else "1 << 30", "true," if clustered else "false,") + best
+        print("    { %7s, %-10s %d, %13d, %8d, %10d },  // %.2f s" % (row + (results[best][1],)))
+        sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
@@ -4,9 +4,49 @@
 #include <cstdlib> // random
 #include <time.h>
 #include <list>
+#include <deque>
 #include <algorithm>
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close
+#include <stdint.h>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <limits>
+#include <functional>
+#include <queue>
 using namespace std;
 
+/**
+ * Releases the memory-mapped distance matrix, if any.
+ */
+TSP::~TSP() {
+    if (matrix != nullptr) {
+        munmap((void*) (matrix - 1), matrix_bytes);
+    }
+}
+
+/**
+ * Removes all points so that a new instance can be added. The buffers keep their
+ * capacity, so solving many instances with the same object does not reallocate.
+ */
+void TSP::clear() {
+    if (matrix != nullptr) {
+        munmap((void*) (matrix - 1), matrix_bytes);
+        matrix = nullptr;
+        matrix_bytes = 0;
+    }
+    points.clear();
+    penalty.clear();
+    n = 0;
+    longest_distance = 0;
+    symmetric = true;
+    symmetry_known = true;
+    target_length = -1;
+}
+
 /**
  * Swaps i and j in given vector
  * @param i    index i
@@ -87,6 +127,40 @@ void TSP::swap(int i, int j, vector<Point>& list) {
 
 }
 
+/**
+ * Moves the path from f to e in between a and the point after a.
+ * @param f        the first point of the path
+ * @param e        the last point of the path
+ * @param a        the point to insert after, not on the path or just before it
+ * @param reversed whether the path is inserted from e to f
+ * @param list     the list to move in
+ */
+void TSP::or_opt_swap(int f, int e, int a, bool reversed, vector<Point>& list) {
+    int b = list[a].next;
+
+    // Close the gap
+    list[list[f].prev].next = list[e].next;
+    list[list[e].next].prev = list[f].prev;
+
+    if (reversed) {
+        // Flip the links on the path so that it runs from e to f
+        int t = f;
+        while (true) {
+            int next = list[t].next;
+            std::swap(list[t].next, list[t].prev);
+            if (t == e) break;
+            t = next;
+        }
+        std::swap(f, e);
+    }
+
+    // Insert the path
+    list[a].next = f;
+    list[f].prev = a;
+    list[e].next = b;
+    list[b].prev = e;
+}
+
 /**
  * Calculates swapping cost between a and b.
  * @param  a    the first index
@@ -105,22 +179,22 @@ void TSP::swap(int i, int j, vector<Point>& list) {
     int at = ap.index;
     int bt = bp.index;
 
-    // Calculate for all different scenarios
+    // Calculate for all different scenarios, edges in the direction of the tour
     if (at == bp1) {
-        int before = dist(ap1, at) + dist(bt, bm1);
-        int after = dist(ap1, bt) + dist(at, bm1);
+        int before = dist(bm1, bt) + dist(bt, at) + dist(at, ap1);
+        int after = dist(bm1, at) + dist(at, bt) + dist(bt, ap1);
 
         return after - before;
     } else if (at == bm1) {
-        int before = dist(am1, at) + dist(bt, bp1);
-        int after = dist(am1, bt) + dist(at, bp1);
+        int before = dist(am1, at) + dist(at, bt) + dist(bt, bp1);
+        int after = dist(am1, bt) + dist(bt, at) + dist(at, bp1);
 
         return after - before;
     } else {
-        int before = dist(at, am1) + dist(at, ap1) +
-        dist(bt, bm1) + dist(bt, bp1);
-        int after = dist(bt, am1) + dist(bt, ap1) +
-        dist(at, bm1) + dist(at, bp1);
+        int before = dist(am1, at) + dist(at, ap1) +
+        dist(bm1, bt) + dist(bt, bp1);
+        int after = dist(am1, bt) + dist(bt, ap1) +
+        dist(bm1, at) + dist(at, bp1);
         
         return after - before;
     }
@@ -128,6 +202,8 @@ void TSP::swap(int i, int j, vector<Point>& list) {
 
 /**
  * Calculate the cost of swapping with two opt.
+ * For an asymmetric distance matrix the reversed path is walked as well, since its
+ * edges change direction.
  * @param  a    the first index
  * @param  b    the first index
  * @param  list the list to swap in
@@ -136,11 +212,99 @@ void TSP::swap(int i, int j, vector<Point>& list) {
 int TSP::two_opt_swap_cost(const int a, const int b, const vector<Point>& list) const {
     int cost = 0;
 
-    cost -= dist(a, list[a].prev);
+    cost -= dist(list[a].prev, a);
     cost -= dist(b, list[b].next);
-    cost += dist(b, list[a].prev);
+    cost += dist(list[a].prev, b);
     cost += dist(a, list[b].next);
-    
+
+    if (!symmetric) {
+        cost += reversal_cost(a, b, list);
+    }
+    return cost;
+}
+
+/**
+ * Calculate the cost of swapping with two opt, with the reversed path looked up in an
+ * index of the unchanged list instead of walked.
+ * @param  a     the first index
+ * @param  b     the first index
+ * @param  list  the list to swap in
+ * @param  index the index of list, from index_tour, only used if the matrix is asymmetric
+ * @return       the cost
+ */
+int TSP::two_opt_swap_cost(int a, int b, const vector<Point>& list, const TourIndex& index) const {
+    int cost = dist(list[a].prev, b) + dist(a, list[b].next) - dist(list[a].prev, a) - dist(b, list[b].next);
+
+    if (!symmetric) {
+        int pa = index.position[a], pb = index.position[b];
+        cost += index.reversal[pb] - index.reversal[pa];
+        if (pb < pa) {
+            cost += index.reversal[n];
+        }
+    }
+    return cost;
+}
+
+/**
+ * Calculate how much longer the path from a to b gets when it is walked backwards,
+ * which is 0 for symmetric distances. Paths of more than 1000 points get a cost that
+ * no move accepts, so that evaluating a move never walks further than that.
+ * @param  a    the first point of the path
+ * @param  b    the last point of the path
+ * @param  list the list the path is in
+ * @return      the cost
+ */
+int TSP::reversal_cost(int a, int b, const vector<Point>& list) const {
+    int cost = 0, steps = 0;
+    for (int x = a; x != b; x = list[x].next) {
+        if (++steps > 1000) {
+            return numeric_limits<int>::max() / 4;
+        }
+        cost += dist(list[x].next, x) - dist(x, list[x].next);
+    }
+    return cost;
+}
+
+/**
+ * Indexes a tour for two_opt_swap_cost, starting from point 0.
+ * @param list  the list to index
+ * @param index is set to the index
+ */
+void TSP::index_tour(const vector<Point>& list, TourIndex& index) const {
+    index.position.resize(n);
+    index.reversal.resize(n + 1);
+    index.reversal[0] = 0;
+    int x = 0;
+    for (int k = 0; k < n; k++) {
+        index.position[x] = k;
+        index.reversal[k + 1] = index.reversal[k] + dist(list[x].next, x) - dist(x, list[x].next);
+        x = list[x].next;
+    }
+}
+
+/**
+ * Calculate the cost of moving the path from f to e in between a and the point after a.
+ * @param  f        the first point of the path
+ * @param  e        the last point of the path
+ * @param  a        the point to insert after, not on the path or just before it
+ * @param  reversed whether the path is inserted from e to f
+ * @param  list     the list to move in
+ * @return          the cost
+ */
+int TSP::or_opt_swap_cost(int f, int e, int a, bool reversed, const vector<Point>& list) const {
+    int p = list[f].prev;
+    int q = list[e].next;
+    int b = list[a].next;
+
+    int cost = dist(p, q) - dist(p, f) - dist(e, q) - dist(a, b);
+    if (reversed) {
+        cost += dist(a, e) + dist(f, b);
+        if (!symmetric) {
+            cost += reversal_cost(f, e, list);
+        }
+    } else {
+        cost += dist(a, f) + dist(e, b);
+    }
     return cost;
 }
 
@@ -155,49 +319,145 @@ int TSP::two_opt_swap_cost(const int a, const int b, const vector<Point>& list)
     n++;
 }
 
+/**
+ * Loads an explicit distance matrix by memory-mapping a binary file.
+ * The file starts with n as a 32 bit integer, followed by n*n 32 bit integers
+ * in row-major order where entry (a, b) is the cost of going from a to b.
+ * Nothing is copied, the pages are read on demand by dist().
+ *
+ * @param  path the file to map
+ * @return      true if the matrix was loaded
+ */
+bool TSP::load_distance_matrix(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        cerr << "Kunde inte öppna " << path << endl;
+        return false;
+    }
+
+    struct stat st;
+    int32_t count = 0;
+    if (fstat(fd, &st) < 0 || read(fd, &count, sizeof(count)) != sizeof(count) || count < 0 ||
+            (size_t) st.st_size != sizeof(int32_t) * (1 + (size_t) count * count)) {
+        cerr << "Felaktig avståndsmatris i " << path << endl;
+        close(fd);
+        return false;
+    }
+
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        cerr << "Kunde inte mappa " << path << endl;
+        return false;
+    }
+
+    // Skip the header, the mapping itself is released in the destructor
+    matrix = (const int*) mapped + 1;
+    matrix_bytes = st.st_size;
+
+    // The points only carry the tour links in this mode
+    points.clear();
+    n = 0;
+    for (int i = 0; i < count; i++) {
+        add_point(0, 0);
+    }
+
+    // Moves account for paths changing direction until the first neighbour list has
+    // compared every entry with its transpose
+    symmetric = false;
+    symmetry_known = false;
+    return true;
+}
+
 /**
  * Populates the neighbour list with neighbours to the entries.
  * Each neighbour list consists of maximum m entries.
+ * Every row is selected on its own, so only O(n) extra memory is needed.
+ * The first scan of a distance matrix also decides whether it is symmetric.
  * 
  * @param m maximum number of entries
  */
  void TSP::compute_neighbour_list(int m) {
-    neighbours.reserve(n);
-    vector<Edge> edges;
+    if (alpha_nearness && !penalty.empty()) {
+        compute_alpha_neighbour_list(m);
+        return;
+    }
+
+    neighbours.resize(n);
+    vector<pair<int, int>> candidates;
+    longest_distance = 0;
+    bool same = true;
 
-    // Create all possible edges (O(n^2)) in the graph and add them to the edge
     for (int i = 0; i < n; i++) {
-        for (int j = 0; j < i; j++) {
+        // All other points are candidates to be neighbours of i, with their distance
+        candidates.clear();
+        for (int j = 0; j < n; j++) {
             if (i == j) continue;
-            Edge e(i, j, dist(i, j));
-            edges.push_back(e);
-        }     
-    }
-
-    // Sort the list, shortest edges first!
-    sort(edges.begin(), edges.end(), [](const Edge & a, const Edge & b) {
-        return a.dist < b.dist;
-    });
+            int d = dist(i, j);
+            candidates.push_back(make_pair(d, j));
+            longest_distance = max(longest_distance, d); // used by SA
+            if (!symmetry_known && same && j < i) {
+                same = d == dist(j, i);
+            }
+        }
 
-    longest_distance = edges.back().dist; // used by SA
+        // Pick the m closest, shortest edges first!
+        int count = min(m, (int) candidates.size());
+        partial_sort(candidates.begin(), candidates.begin() + count, candidates.end());
+        neighbours[i].resize(count);
+        for (int k = 0; k < count; k++) {
+            neighbours[i][k] = candidates[k].second;
+        }
+    }
 
-    // Reserve some space for neighbours
-    neighbours.reserve(n);
+    if (!symmetry_known) {
+        symmetric = same;
+        symmetry_known = true;
+    }
+}
 
-    // Loop through each neighbour list and add the vector
-    for(int i = 0; i < n; i++) {
-        neighbours.push_back(vector<int>()); 
+/**
+ * Estimates size, spread and clustering of the instance.
+ * For each sampled point the distance to all others is examined, which gives the mean
+ * distance and the nearest neighbour distance. In a uniform instance the nearest neighbour
+ * is about 0.96 * mean / sqrt(n) away, clustered instances have much closer neighbours.
+ * Only dist() is used, so it works for distance matrices as well.
+ *
+ * @param  samples number of points to sample
+ * @return         the features
+ */
+Features TSP::features(int samples) const {
+    Features f;
+    f.n = n;
+    f.spread = 0;
+    f.clustering = 0;
+    if (n < 2) {
+        return f;
     }
 
-    // Now, loop through the sorted list of edges and insert the neighbors to the list
-    for (auto & edge : edges) {
-        if (neighbours[edge.a].size() < m) {
-            neighbours[edge.a].push_back(edge.b);
-        }
-        if (neighbours[edge.b].size() < m) {
-            neighbours[edge.b].push_back(edge.a);
+    samples = min(samples, n);
+    double total = 0, nearest = 0;
+    for (int s = 0; s < samples; s++) {
+        int i = (int) ((long long) s * n / samples);
+        int closest = -1;
+        for (int j = 0; j < n; j++) {
+            if (i == j) continue;
+            int d = dist(i, j);
+            total += d;
+            if (closest == -1 || d < closest) {
+                closest = d;
+            }
         }
+        nearest += closest;
+    }
+    f.spread = total / ((double) samples * (n - 1));
+    nearest /= samples;
+
+    if (f.spread > 0) {
+        double ratio = nearest * sqrt((double) n) / (0.96 * f.spread);
+        f.clustering = max(0.0, 1.0 - min(1.0, ratio));
     }
+    return f;
 }
 
 /**
@@ -219,7 +479,7 @@ int TSP::two_opt_swap_cost(const int a, const int b, const vector<Point>& list)
  */
 int TSP::total_dist(const vector<Point>& vec) const {
     int distance = 0;
-    for(int i = 1; i < n; ++i) {
+    for(int i = 0; i < n; ++i) {
         distance += dist(i, vec[i].next);
     }
 
@@ -227,13 +487,22 @@ int TSP::total_dist(const vector<Point>& vec) const {
 }
 
 /**
- * Returns the euclidian distance between the two points a and b.
- * @param  a point
- * @param  b point
- * @return   a euclidian distance rounded to integer
+ * Reverses the tour if it is shorter the other way around, which can only happen with
+ * an asymmetric distance matrix.
  */
-int TSP::dist(int a, int b) const {
-    return (int) (sqrt((points[a].x-points[b].x)*(points[a].x-points[b].x) + (points[a].y-points[b].y)*(points[a].y-points[b].y)) + 0.5);
+void TSP::orient_tour() {
+    if (matrix == nullptr) {
+        return;
+    }
+    int backward = 0;
+    for (int i = 0; i < n; ++i) {
+        backward += dist(points[i].next, i);
+    }
+    if (backward < total_dist()) {
+        for (int i = 0; i < n; ++i) {
+            std::swap(points[i].next, points[i].prev);
+        }
+    }
 }
 
 /**
@@ -241,11 +510,421 @@ int TSP::dist(int a, int b) const {
  * Just prints the points list, one on each line.
  */
  void TSP::print_result() const{
+    print_result(cout);
+}
+
+/**
+ * Prints the result to the given stream, one point on each line.
+ * @param out the stream to print to
+ */
+void TSP::print_result(ostream& out) const {
+    if (n == 0) {
+        return;
+    }
     int i = 0;
     do {
-        cout << i << endl;
+        out << i << '\n';
         i = points[i].next;
     } while(i != 0);
+    out.flush();
+}
+
+// ########################################################################################
+// ########################################################################################
+// ####################### Lower bound ####################################################
+// ########################################################################################
+// ########################################################################################
+/**
+ * Cost of the edge between a and b with the node penalties added. For an asymmetric
+ * distance matrix the cheaper direction is used, which keeps the bound valid.
+ * @param  a point
+ * @param  b point
+ * @return   the penalized cost
+ */
+double TSP::penalized_dist(int a, int b) const {
+    int d = matrix != nullptr ? min(dist(a, b), dist(b, a)) : dist(a, b);
+    return d + penalty[a] + penalty[b];
+}
+
+/**
+ * Computes a minimum 1-tree with the current penalties: a minimum spanning tree over
+ * the points 1..n-1 and the two cheapest edges from point 0. With a graph given, only
+ * its edges are used (Prim with a heap), otherwise all edges are (Prim in O(n^2)).
+ * @param  graph  adjacency lists to use, or empty for the complete graph
+ * @param  degree gets the degree of each point in the 1-tree
+ * @param  parent gets the parent of each point in the tree, -1 for 0 and the root 1
+ * @return        the cost of the 1-tree minus twice the penalties, or NaN if the graph does not span
+ */
+double TSP::one_tree(const vector<vector<int>>& graph, vector<int>& degree, vector<int>& parent) const {
+    degree.assign(n, 0);
+    parent.assign(n, -1);
+    vector<double> key(n, numeric_limits<double>::max());
+    vector<bool> in_tree(n, false);
+    in_tree[0] = true;
+    key[1] = 0;
+    double total = 0;
+    int count = 0;
+
+    if (graph.empty()) {
+        for (int k = 1; k < n; k++) {
+            int u = -1;
+            for (int v = 1; v < n; v++) {
+                if (!in_tree[v] && (u == -1 || key[v] < key[u])) u = v;
+            }
+            in_tree[u] = true;
+            total += key[u];
+            count++;
+            for (int v = 1; v < n; v++) {
+                if (in_tree[v]) continue;
+                double w = penalized_dist(u, v);
+                if (w < key[v]) {
+                    key[v] = w;
+                    parent[v] = u;
+                }
+            }
+        }
+    } else {
+        priority_queue<pair<double, int>, vector<pair<double, int>>, greater<pair<double, int>>> heap;
+        heap.push(make_pair(0.0, 1));
+        while (!heap.empty()) {
+            int u = heap.top().second;
+            heap.pop();
+            if (in_tree[u]) continue;
+            in_tree[u] = true;
+            total += key[u];
+            count++;
+            for (int v : graph[u]) {
+                if (in_tree[v]) continue;
+                double w = penalized_dist(u, v);
+                if (w < key[v]) {
+                    key[v] = w;
+                    parent[v] = u;
+                    heap.push(make_pair(w, v));
+                }
+            }
+        }
+    }
+    if (count < n - 1) {
+        return numeric_limits<double>::quiet_NaN();
+    }
+    for (int v = 2; v < n; v++) {
+        degree[v]++;
+        degree[parent[v]]++;
+    }
+
+    // Connect point 0 with its two cheapest edges
+    int first = -1, second = -1;
+    int candidates = graph.empty() ? n : graph[0].size();
+    for (int x = 0; x < candidates; x++) {
+        int v = graph.empty() ? x : graph[0][x];
+        if (v == 0) continue;
+        double w = penalized_dist(0, v);
+        if (first == -1 || w < penalized_dist(0, first)) {
+            second = first;
+            first = v;
+        } else if (second == -1 || w < penalized_dist(0, second)) {
+            second = v;
+        }
+    }
+    if (second == -1) {
+        return numeric_limits<double>::quiet_NaN();
+    }
+    total += penalized_dist(0, first) + penalized_dist(0, second);
+    degree[0] = 2;
+    degree[first]++;
+    degree[second]++;
+
+    for (int v = 0; v < n; v++) {
+        total -= 2 * penalty[v];
+    }
+    return total;
+}
+
+/**
+ * Finds the clusters of the single linkage hierarchy that stand out, either because
+ * their merge distance is at least twice the longest edge inside them, or because it
+ * is at least five times the median edge of the minimum spanning tree. Points in a
+ * tight cluster have to be penalized together to get the two edges across the cut
+ * around it into the 1-tree, which steps on single points only reach very slowly.
+ * @param  parent the minimum spanning tree over 1..n-1, as from one_tree
+ * @param  gap    is set to the merge distance of each cluster
+ * @return        the points of each cluster
+ */
+vector<vector<int>> TSP::penalty_clusters(const vector<int>& parent, vector<double>& gap) const {
+    // The tree edges, with point 0 attached to its closest point
+    vector<Edge> tree;
+    int closest = 1;
+    for (int v = 2; v < n; v++) {
+        tree.push_back(Edge(v, parent[v], dist(v, parent[v])));
+        if (dist(0, v) < dist(0, closest)) closest = v;
+    }
+    tree.push_back(Edge(0, closest, dist(0, closest)));
+    sort(tree.begin(), tree.end(), [](const Edge& a, const Edge& b) { return a.dist < b.dist; });
+    double median = tree[tree.size() / 2].dist;
+
+    // Merge in order of length, members and longest edge are kept at the root of each set
+    vector<int> root(n);
+    vector<vector<int>> members(n);
+    vector<double> longest(n, 0);
+    for (int v = 0; v < n; v++) {
+        root[v] = v;
+        members[v].push_back(v);
+    }
+    function<int(int)> find_root = [&](int v) {
+        return root[v] == v ? v : root[v] = find_root(root[v]);
+    };
+
+    vector<vector<int>> clusters;
+    gap.clear();
+    for (const Edge& e : tree) {
+        int a = find_root(e.a), b = find_root(e.b);
+        for (int r : { a, b }) {
+            if (members[r].size() >= 2 && (e.dist >= 2 * longest[r] || e.dist >= 5 * median)) {
+                clusters.push_back(members[r]);
+                gap.push_back(e.dist);
+            }
+        }
+        if (members[a].size() < members[b].size()) {
+            std::swap(a, b);
+        }
+        members[a].insert(members[a].end(), members[b].begin(), members[b].end());
+        vector<int>().swap(members[b]);
+        root[b] = a;
+        longest[a] = e.dist;
+    }
+    return clusters;
+}
+
+/**
+ * Computes the Held-Karp lower bound on the tour length. Node penalties are optimized by
+ * subgradient ascent, pushing points with degree above 2 in the minimum 1-tree away and
+ * pulling leaves in. The clusters from penalty_clusters are moved as a whole as well,
+ * along the sum of the subgradient over their points, which is the number of 1-tree
+ * edges across the cluster minus 2. Points and clusters each get half of a Polyak step
+ * towards a closest neighbour tour, so that the few cluster terms are not drowned out,
+ * and the step is halved after 30 iterations without improvement. The cluster moves
+ * of a point are capped at half the merge distance of its cluster per iteration, as
+ * nested clusters otherwise push each other far past the point where the cut flips.
+ * The iterations run on the neighbour graph, which is cheap. Every 20 iterations, or n/50
+ * for large n, and whenever the 1-tree on the neighbour graph is longer than the tour,
+ * the 1-tree is computed over the complete graph instead. That adds the edges the
+ * penalties have made attractive to the neighbour graph, and gives a valid bound. If
+ * it is shorter than the 1-tree on the neighbour graph, the best value so far may be
+ * just as wrong and is replaced. The best valid bound is returned, never less than the
+ * 1-tree without penalties, and its penalties are kept for alpha-nearness neighbour
+ * lists.
+ * @param  iterations number of subgradient iterations
+ * @param  m          maximum number of neighbours in neighbour list
+ * @return            a lower bound on the length of every tour
+ */
+double TSP::lower_bound(int iterations, int m) {
+    log("Beräknar undre gräns.");
+
+    if (n < 3) {
+        return total_dist();
+    }
+
+    penalty.assign(n, 0);
+    m = min(max(m, 2), n-1);
+    compute_neighbour_list(m);
+
+    // Make the neighbour graph symmetric, and connected by adding the edges of a minimum
+    // spanning tree, which clustered instances otherwise often are not. With at least two
+    // neighbours of point 0 a 1-tree always exists on it
+    vector<vector<int>> graph(neighbours);
+    auto add_edge = [&](int a, int b) {
+        if (find(graph[a].begin(), graph[a].end(), b) == graph[a].end()) {
+            graph[a].push_back(b);
+            graph[b].push_back(a);
+        }
+    };
+    vector<int> degree, parent;
+    vector<vector<int>> complete;
+    vector<double> gap;
+    double valid = one_tree(complete, degree, parent);
+    vector<vector<int>> clusters = penalty_clusters(parent, gap);
+    for (int v = 2; v < n; v++) {
+        add_edge(v, parent[v]);
+    }
+    for (int i = 0; i < n; i++) {
+        for (int j : neighbours[i]) {
+            add_edge(j, i);
+        }
+    }
+
+    // Upper bound for the step size, from a closest neighbour tour
+    vector<Point> tour(points);
+    nearest_neighbour_tour(0, tour);
+    double upper = total_dist(tour);
+
+    vector<double> best_penalty(penalty), valid_penalty(penalty);
+    vector<double> direction(n, 0), cluster_direction(clusters.size(), 0);
+    vector<int> sum(clusters.size());
+    vector<double> move(n), cap(n, 0);
+    for (size_t c = 0; c < clusters.size(); c++) {
+        for (int v : clusters[c]) {
+            cap[v] = max(cap[v], 0.5 * gap[c]);
+        }
+    }
+    double best = -numeric_limits<double>::max(), step = 1;
+    int since = 0, refresh = max(20, n / 50);
+    for (int iter = 0; iter < iterations; iter++) {
+        double w = one_tree(graph, degree, parent);
+
+        // A 1-tree longer than a tour means that the neighbour graph lacks edges
+        if (iter % refresh == refresh - 1 || w >= upper) {
+            double sparse = w;
+            w = one_tree(complete, degree, parent);
+            for (int v = 2; v < n; v++) {
+                add_edge(v, parent[v]);
+            }
+            if (w > valid) {
+                valid = w;
+                valid_penalty = penalty;
+            }
+            if (w < sparse && w < best) {
+                best = w;
+                best_penalty = penalty;
+            }
+        }
+
+        if (w > best) {
+            best = w;
+            best_penalty = penalty;
+            since = 0;
+        } else if (++since >= 30) {
+            step /= 2;
+            since = 0;
+        }
+
+        int norm = 0, cluster_norm = 0;
+        for (int v = 0; v < n; v++) {
+            norm += (degree[v] - 2) * (degree[v] - 2);
+        }
+        if (norm == 0) {
+            // The 1-tree is a tour
+            break;
+        }
+        for (size_t c = 0; c < clusters.size(); c++) {
+            sum[c] = 0;
+            for (int v : clusters[c]) {
+                sum[c] += degree[v] - 2;
+            }
+            cluster_norm += sum[c] * sum[c];
+        }
+
+        // Move along the subgradient, smoothed with the previous one to damp zig-zagging
+        double t = 0.5 * step * (upper - w) / norm;
+        for (int v = 0; v < n; v++) {
+            direction[v] = 0.7 * (degree[v] - 2) + 0.3 * direction[v];
+            penalty[v] += t * direction[v];
+        }
+        double tc = cluster_norm == 0 ? 0 : 0.5 * step * (upper - w) / cluster_norm;
+        fill(move.begin(), move.end(), 0);
+        for (size_t c = 0; c < clusters.size(); c++) {
+            cluster_direction[c] = 0.7 * sum[c] + 0.3 * cluster_direction[c];
+            double d = max(-0.5 * gap[c], min(0.5 * gap[c], tc * cluster_direction[c]));
+            for (int v : clusters[c]) {
+                move[v] += d;
+            }
+        }
+        for (int v = 0; v < n; v++) {
+            penalty[v] += max(-cap[v], min(cap[v], move[v]));
+        }
+    }
+
+    // The best penalties on the neighbour graph, unless an earlier complete 1-tree was better
+    penalty = best_penalty;
+    double w = one_tree(complete, degree, parent);
+    if (valid > w) {
+        penalty = valid_penalty;
+        w = valid;
+    }
+    return w;
+}
+
+/**
+ * Populates the neighbour list with the m alpha-nearest neighbours of each point.
+ * The alpha value of an edge is how much the minimum 1-tree grows if the edge is
+ * forced into it: its penalized cost minus the most expensive edge on the tree path
+ * between its ends. Edges in optimal tours tend to have small alpha values even when
+ * they are not among the shortest. Takes O(n^2) time, the penalties from lower_bound
+ * are used.
+ * @param m maximum number of entries
+ */
+void TSP::compute_alpha_neighbour_list(int m) {
+    vector<vector<int>> complete;
+    vector<int> degree, parent;
+    one_tree(complete, degree, parent);
+
+    // Order the tree so that parents come before their children
+    vector<vector<int>> children(n);
+    for (int v = 2; v < n; v++) {
+        children[parent[v]].push_back(v);
+    }
+    vector<int> order(1, 1);
+    for (size_t k = 0; k < order.size(); k++) {
+        for (int v : children[order[k]]) {
+            order.push_back(v);
+        }
+    }
+
+    // The two edges of point 0 in the 1-tree, and the cost of the more expensive one
+    vector<int> by_cost;
+    for (int v = 1; v < n; v++) {
+        by_cost.push_back(v);
+    }
+    partial_sort(by_cost.begin(), by_cost.begin() + 2, by_cost.end(), [&](int a, int b) {
+        return penalized_dist(0, a) < penalized_dist(0, b);
+    });
+    double second = penalized_dist(0, by_cost[1]);
+
+    neighbours.resize(n);
+    vector<double> beta(n), alpha(n);
+    vector<int> mark(n, -1), candidates;
+    for (int i = 0; i < n; i++) {
+        if (i == 0) {
+            for (int j = 1; j < n; j++) {
+                alpha[j] = penalized_dist(0, j) - second;
+            }
+        } else {
+            // beta[j] is the most expensive edge on the tree path from i to j
+            beta[i] = -numeric_limits<double>::max();
+            mark[i] = i;
+            for (int u = i; parent[u] != -1; u = parent[u]) {
+                beta[parent[u]] = max(beta[u], penalized_dist(u, parent[u]));
+                mark[parent[u]] = i;
+            }
+            for (int j : order) {
+                if (mark[j] != i) {
+                    beta[j] = max(beta[parent[j]], penalized_dist(j, parent[j]));
+                }
+            }
+            for (int j = 1; j < n; j++) {
+                alpha[j] = j == i ? 0 : penalized_dist(i, j) - beta[j];
+            }
+            alpha[0] = penalized_dist(i, 0) - second;
+        }
+
+        candidates.clear();
+        for (int j = 0; j < n; j++) {
+            if (j != i) candidates.push_back(j);
+        }
+        int count = min(m, (int) candidates.size());
+        partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(), [&](int a, int b) {
+            return alpha[a] < alpha[b] || (alpha[a] == alpha[b] && dist(i, a) < dist(i, b));
+        });
+        neighbours[i].assign(candidates.begin(), candidates.begin() + count);
+    }
+}
+
+/**
+ * Makes the improving algorithms stop once the tour is within the given gap of the bound.
+ * @param bound a lower bound on the tour length
+ * @param gap   the accepted gap, e.g. 0.01 for 1%
+ */
+void TSP::set_gap_target(double bound, double gap) {
+    target_length = (int) (bound * (1 + gap));
 }
 
 // ########################################################################################
@@ -257,10 +936,11 @@ int TSP::dist(int a, int b) const {
  * Executes shortest edge algorithm.
  */
 void TSP::exec_shortest_edge()  {
-    cerr << "Kör shortest edge." << endl;
+    log("Kör shortest edge.");
 
-    // Create a list of edges
-    vector<Edge> edges;
+    // Reuse the list of edges from earlier instances
+    edges.clear();
+    edges.reserve((size_t) n * (n - 1) / 2);
 
     // Create all possible edges (n^2) in the graph and add them to the list
     int x = 0;
@@ -324,6 +1004,11 @@ void TSP::exec_shortest_edge()  {
     }
     points[node].next = 0;
     points[0].prev = node;
+
+    // Only small lists are kept for reuse, a large one would stay allocated in every worker
+    if (edges.capacity() > (1 << 20)) {
+        vector<Edge>().swap(edges);
+    }
 }
 
 /**
@@ -376,7 +1061,7 @@ void TSP::exec_shortest_edge()  {
  * Naive algorithm.
  */
 void TSP::exec_naive() {
-    cerr << "Kör naiva." << endl;
+    log("Kör naiva.");
     // Init some arrays where we will store the tour
     // tour[x] will, when we have calculated the tour up to x, contain a tour from 0 to x.
     //          The other values are undefined.
@@ -419,63 +1104,627 @@ void TSP::exec_naive() {
 
 // ########################################################################################
 // ########################################################################################
-// ####################### 2-OPT ##########################################################
+// ####################### Savings ########################################################
 // ########################################################################################
 // ########################################################################################
 /**
- * Improves a solution with 2-OPT
- * @param  k_max maximum number of iterations
- * @return       number of iterations
+ * Executes the Clarke-Wright savings algorithm. All points start on their own route
+ * from a hub point near the middle and back. Joining the routes of i and j saves
+ * dist(hub, i) + dist(hub, j) - dist(i, j), so pairs are taken from a heap, largest
+ * saving first, and joined if both are ends of different routes (union-find). Only
+ * pairs from the neighbour lists are considered, and any routes left at the end are
+ * joined closest end first.
+ * @param m maximum number of neighbours in neighbour list
  */
-int TSP::improve_two_opt(int k_max) {
-    cerr << "Kör 2-opt (vanlig)." << endl;
-
-    // Set some initial state variables
-    srand(time(NULL));
-    int current_score = total_dist();
-    bool improvement = true;
-    int max_iter = k_max;
-    int iter = 0;
-
-    // Loop until no improvement can be made, but maximum max_iter times
-    for (; improvement && iter < max_iter; ++iter) { 
-        improvement = false;
-        int i = 0;
-        int iMax = 0, jMax = 0, valMax = 0;
-        // Loop and find the best move, then do the move after the loop
-        do {
-            int j = points[i].next;
-
-            // Find j's neighbours
-            while(j != 0 && !improvement) {
-                int swapCost = 0;
+void TSP::exec_savings(int m) {
+    log("Kör savings.");
 
-                if (j == points[i].prev) {
-                    // We are swapping everythinng
-                    swapCost = 0;
-                } else if (j == points[i].next) {
-                    swapCost = swap_cost(i, j, points);
-                } else {
-                    swapCost = two_opt_swap_cost(i, j, points);
-                }
-                
-                if (swapCost < valMax) {
-                    // If we found new max, save it
-                    valMax = swapCost;
-                    iMax = i;
-                    jMax = j;
-                }
+    m = m < n-1 ? m : n-1;
+    compute_neighbour_list(m);
 
-                j = points[j].next;
+    // The hub is the point closest to the centre of gravity, or 0 for a distance matrix
+    int hub = 0;
+    if (matrix == nullptr) {
+        double cx = 0, cy = 0;
+        for (const Point & p : points) {
+            cx += p.x / n;
+            cy += p.y / n;
+        }
+        for (int i = 1; i < n; i++) {
+            if (hypot(points[i].x - cx, points[i].y - cy) < hypot(points[hub].x - cx, points[hub].y - cy)) {
+                hub = i;
             }
-            i = points[i].next;
-        } while (i != 0 && !improvement);
+        }
+    }
 
-        // Perform max if it is good enough
+    // Heap of savings, largest first
+    auto by_saving = [](const Edge & a, const Edge & b) {
+        return a.dist < b.dist;
+    };
+    priority_queue<Edge, vector<Edge>, decltype(by_saving)> heap(by_saving);
+    for (int i = 0; i < n; i++) {
+        if (i == hub) continue;
+        for (int j : neighbours[i]) {
+            if (j == hub) continue;
+            heap.push(Edge(i, j, dist(hub, i) + dist(hub, j) - dist(i, j)));
+        }
+    }
+
+    // Union-find over the routes, and the (at most two) links of each point
+    vector<int> route(n), degree(n, 0), link(2 * n, -1);
+    for (int i = 0; i < n; i++) {
+        route[i] = i;
+    }
+    auto find = [&](int x) {
+        while (route[x] != x) {
+            route[x] = route[route[x]];
+            x = route[x];
+        }
+        return x;
+    };
+
+    int joins = 0;
+    while (!heap.empty() && joins < n - 2) {
+        Edge e = heap.top();
+        heap.pop();
+        if (degree[e.a] > 1 || degree[e.b] > 1 || find(e.a) == find(e.b)) continue;
+
+        link[2 * e.a + degree[e.a]++] = e.b;
+        link[2 * e.b + degree[e.b]++] = e.a;
+        route[find(e.a)] = find(e.b);
+        joins++;
+    }
+
+    // Walk the routes, continuing from the end of one to the closest end of another
+    vector<int> order(1, hub);
+    vector<bool> visited(n, false);
+    visited[hub] = true;
+    vector<int> ends;
+    for (int i = 0; i < n; i++) {
+        if (i != hub && degree[i] < 2) ends.push_back(i);
+    }
+
+    int current = hub;
+    while ((int) order.size() < n) {
+        int start = -1;
+        for (int e : ends) {
+            if (!visited[e] && (start == -1 || dist(current, e) < dist(current, start))) {
+                start = e;
+            }
+        }
+
+        int prev = -1;
+        current = start;
+        while (current != -1) {
+            order.push_back(current);
+            visited[current] = true;
+            int next = link[2 * current] != prev ? link[2 * current] : link[2 * current + 1];
+            prev = current;
+            current = next == -1 || visited[next] ? -1 : next;
+        }
+        current = prev;
+    }
+
+    set_tour(order, points);
+}
+
+// ########################################################################################
+// ########################################################################################
+// ####################### Multilevel #####################################################
+// ########################################################################################
+// ########################################################################################
+/**
+ * Improves a tour over the given points with 2-opt and Or-opt moves drawn from the
+ * candidate lists. Points whose surroundings changed are queued again, until no move
+ * improves the tour. The list only has to link the given points, so coarse levels of
+ * the multilevel solver can be refined as well.
+ * @param active the points in the tour
+ * @param near   candidate lists, indexed by point
+ * @param m      maximum number of candidates to try per point
+ * @param list   the tour to improve
+ */
+void TSP::refine_level(const vector<int>& active, const vector<vector<int>>& near, int m, vector<Point>& list) {
+    int count = active.size();
+    if (count < 5) {
+        return;
+    }
+
+    deque<int> queue(active.begin(), active.end());
+    vector<bool> queued(n, false);
+    for (int a : active) {
+        queued[a] = true;
+    }
+
+    vector<int> touched;
+    while (!queue.empty()) {
+        int i = queue.front();
+        queue.pop_front();
+        queued[i] = false;
+        touched.clear();
+
+        int candidates = min(m, (int) near[i].size());
+
+        // 2-opt: add the edge (i, j) as in two_opt_queue
+        for (int x = 0; x < candidates && touched.empty(); x++) {
+            int j = near[i][x];
+            int a = -1, b = -1;
+            if (j != list[i].next && two_opt_swap_cost(list[i].next, j, list) < 0) {
+                a = list[i].next;
+                b = j;
+            } else if (j != list[i].prev && two_opt_swap_cost(j, list[i].prev, list) < 0) {
+                a = j;
+                b = list[i].prev;
+            }
+            if (a == -1) continue;
+
+            touched = { list[a].prev, a, b, list[b].next };
+            two_opt_swap(a, b, list);
+        }
+
+        // Or-opt: move the segment of up to three points starting at i in between
+        // a candidate of either end and its successor or predecessor, in either orientation
+        for (int len = 1; len <= 3 && len <= count - 3 && touched.empty(); len++) {
+            int segment[3] = { i, -1, -1 };
+            for (int s = 1; s < len; s++) {
+                segment[s] = list[segment[s-1]].next;
+            }
+            int f = segment[0], e = segment[len-1];
+
+            auto inside = [&](int v) {
+                return find(segment, segment + len, v) != segment + len;
+            };
+
+            for (int end = 0; end < 2 && touched.empty(); end++) {
+                int u = end == 0 ? f : e;
+                int size = min(m, (int) near[u].size());
+                for (int x = 0; x < size * 2 && touched.empty(); x++) {
+                    int c = near[u][x / 2];
+                    int a = x % 2 == 0 ? c : list[c].prev;
+                    int b = list[a].next;
+                    if (inside(a) || inside(b)) continue;
+
+                    int forward = or_opt_swap_cost(f, e, a, false, list);
+                    int reversed = or_opt_swap_cost(f, e, a, true, list);
+                    if (min(forward, reversed) >= 0) continue;
+
+                    touched = { list[f].prev, list[e].next, a, b };
+                    touched.insert(touched.end(), segment, segment + len);
+                    or_opt_swap(f, e, a, reversed < forward, list);
+                }
+            }
+        }
+
+        for (int t : touched) {
+            if (!queued[t]) {
+                queued[t] = true;
+                queue.push_back(t);
+            }
+        }
+    }
+}
+
+/**
+ * Multilevel solver. The points are repeatedly coarsened by matching each point with
+ * its closest unmatched candidate, where the pair is represented by one of its points
+ * and its candidates are the representatives of the candidates of both points. The
+ * matching starts with the points that have the closest neighbours. The coarsest level
+ * is solved with a closest neighbour tour, and the levels are then expanded one by one,
+ * inserting each matched point on the cheaper side of its representative and refining
+ * with 2-opt and Or-opt. Works on distance matrices too, since only dist() is used.
+ * @param m maximum number of neighbours in neighbour list
+ */
+void TSP::exec_multilevel(int m) {
+    log("Kör multilevel.");
+
+    if (n < 8) {
+        exec_naive();
+        return;
+    }
+
+    m = m < n-1 ? m : n-1;
+    compute_neighbour_list(m);
+
+    // actives[l] are the points at level l, partners[l][i] is the point matched with
+    // actives[l+1][i] and nears[l] are the candidate lists of actives[l] for l > 0
+    vector<vector<int>> actives(1), partners;
+    vector<vector<vector<int>>> nears(1);
+    for (int i = 0; i < n; i++) {
+        actives[0].push_back(i);
+    }
+    vector<vector<int>> near(n), next(n);
+    for (int i = 0; i < n; i++) {
+        near[i].assign(neighbours[i].begin(), neighbours[i].begin() + min(m, (int) neighbours[i].size()));
+    }
+
+    vector<int> representative(n);
+    vector<bool> matched(n);
+    while (actives.back().size() > 3) {
+        const vector<int>& active = actives.back();
+
+        // Match the points with the closest neighbours first
+        vector<pair<int, int>> order;
+        for (int a : active) {
+            order.push_back(make_pair(near[a].empty() ? numeric_limits<int>::max() : dist(a, near[a][0]), a));
+        }
+        sort(order.begin(), order.end());
+
+        vector<int> reps, partner;
+        for (int a : active) {
+            matched[a] = false;
+        }
+        for (const pair<int, int>& o : order) {
+            int a = o.second;
+            if (matched[a]) continue;
+            matched[a] = true;
+            int b = -1;
+            for (int c : near[a]) {
+                if (!matched[c]) {
+                    b = c;
+                    matched[c] = true;
+                    break;
+                }
+            }
+            representative[a] = a;
+            if (b != -1) representative[b] = a;
+            reps.push_back(a);
+            partner.push_back(b);
+        }
+
+        // Stop when nothing can be matched anymore, the rest is left to the coarsest level
+        if (reps.size() * 10 > active.size() * 9) break;
+
+        // Candidates of a pair are the representatives of the candidates of both points
+        for (size_t r = 0; r < reps.size(); r++) {
+            int a = reps[r], b = partner[r];
+            vector<int>& candidates = next[a];
+            candidates.clear();
+            for (int k = 0; k < 2; k++) {
+                if (k == 1 && b == -1) break;
+                for (int c : near[k == 0 ? a : b]) {
+                    int rc = representative[c];
+                    if (rc != a && find(candidates.begin(), candidates.end(), rc) == candidates.end()) {
+                        candidates.push_back(rc);
+                    }
+                }
+            }
+            sort(candidates.begin(), candidates.end(), [&](int x, int y) { return dist(a, x) < dist(a, y); });
+            if ((int) candidates.size() > m) candidates.resize(m);
+        }
+
+        if (actives.size() > 1) {
+            nears.push_back(vector<vector<int>>());
+            for (int a : active) {
+                nears.back().push_back(near[a]);
+            }
+        }
+        for (int a : reps) {
+            std::swap(near[a], next[a]);
+        }
+        actives.push_back(reps);
+        partners.push_back(partner);
+    }
+    log("Nivåer: " + to_string(actives.size()) + ", grövsta: " + to_string(actives.back().size()));
+
+    // Solve the coarsest level with a closest neighbour tour
+    vector<Point> list(points);
+    const vector<int>& coarsest = actives.back();
+    vector<bool> visited(n, false);
+    int current = coarsest[0];
+    visited[current] = true;
+    for (size_t k = 1; k < coarsest.size(); k++) {
+        int closest = -1;
+        for (int c : coarsest) {
+            if (!visited[c] && (closest == -1 || dist(current, c) < dist(current, closest))) {
+                closest = c;
+            }
+        }
+        list[current].next = closest;
+        list[closest].prev = current;
+        visited[closest] = true;
+        current = closest;
+    }
+    list[current].next = coarsest[0];
+    list[coarsest[0]].prev = current;
+    refine_level(coarsest, near, m, list);
+
+    // Expand and refine the levels
+    for (int l = (int) actives.size() - 2; l >= 0; l--) {
+        const vector<int>& reps = actives[l+1];
+        for (size_t r = 0; r < reps.size(); r++) {
+            int a = reps[r], b = partners[l][r];
+            if (b == -1) continue;
+
+            // Insert b before or after a, whichever is cheaper
+            int before = list[a].prev, after = list[a].next;
+            int x = a;
+            if (dist(before, b) + dist(b, a) - dist(before, a) < dist(a, b) + dist(b, after) - dist(a, after)) {
+                x = before;
+            }
+            int y = list[x].next;
+            list[x].next = b;
+            list[b].prev = x;
+            list[b].next = y;
+            list[y].prev = b;
+        }
+
+        if (l == 0) {
+            refine_level(actives[0], neighbours, m, list);
+        } else {
+            for (size_t i = 0; i < actives[l].size(); i++) {
+                std::swap(near[actives[l][i]], nears[l][i]);
+            }
+            refine_level(actives[l], near, m, list);
+        }
+    }
+
+    points = list;
+}
+
+// ########################################################################################
+// ########################################################################################
+// ####################### Exact ##########################################################
+// ########################################################################################
+// ########################################################################################
+/**
+ * Finds an optimal tour with the Held-Karp dynamic program in O(2^n n^2) time.
+ * dp[mask][j] is the shortest path from 0 through the points in mask ending in j,
+ * where point 0 is left out of the masks. The entries for one mask lie next to
+ * each other, and the distances are looked up in a small precomputed matrix.
+ * Only meant for n up to about 20.
+ */
+void TSP::exec_held_karp() {
+    log("Kör Held-Karp.");
+
+    // Precompute the distances, dist() is too slow for the inner loop
+    vector<int> cost(n * n);
+    for (int a = 0; a < n; a++) {
+        for (int b = 0; b < n; b++) {
+            cost[a * n + b] = dist(a, b);
+        }
+    }
+
+    // Point i + 1 is bit i
+    const int k = n - 1;
+    const size_t subsets = (size_t) 1 << k;
+    const int inf = numeric_limits<int>::max() / 2;
+    vector<int> dp(subsets * k, inf);
+    for (int j = 0; j < k; j++) {
+        dp[((size_t) 1 << j) * k + j] = cost[j + 1];
+    }
+
+    for (size_t mask = 1; mask < subsets; mask++) {
+        const int* row = &dp[mask * k];
+        for (int j = 0; j < k; j++) {
+            if (!(mask & ((size_t) 1 << j)) || row[j] >= inf) continue;
+            const int* from = &cost[(j + 1) * n + 1];
+            for (int l = 0; l < k; l++) {
+                if (mask & ((size_t) 1 << l)) continue;
+                int& target = dp[(mask | ((size_t) 1 << l)) * k + l];
+                target = min(target, row[j] + from[l]);
+            }
+        }
+    }
+
+    // Close the tour and walk back through the table
+    size_t mask = subsets - 1;
+    int last = 0;
+    for (int j = 1; j < k; j++) {
+        if (dp[mask * k + j] + cost[(j + 1) * n] < dp[mask * k + last] + cost[(last + 1) * n]) {
+            last = j;
+        }
+    }
+
+    vector<int> order(n);
+    order[0] = 0;
+    for (int p = n - 1; p > 0; p--) {
+        order[p] = last + 1;
+        size_t rest = mask ^ ((size_t) 1 << last);
+        if (rest == 0) break;
+        for (int i = 0; i < k; i++) {
+            if ((rest & ((size_t) 1 << i)) && dp[rest * k + i] + cost[(i + 1) * n + last + 1] == dp[mask * k + last]) {
+                mask = rest;
+                last = i;
+                break;
+            }
+        }
+    }
+
+    set_tour(order, points);
+}
+
+/**
+ * Improves the solution to an optimal tour with depth first branch and bound. Paths are
+ * extended from 0, closest point first. A path is cut off when its length plus a 1-tree
+ * style bound for the rest, the minimum spanning tree of the unvisited points and the
+ * cheapest edges connecting it to both ends of the path, is no better than the best tour.
+ * The first upper bound is the current tour polished with 2-opt.
+ * @param  max_nodes maximum number of search nodes before giving up
+ * @return           true if the tour is proven optimal, false if the node budget or the
+ *                   gap target stopped the search, then it is the best found
+ */
+bool TSP::improve_branch_and_bound(long long max_nodes) {
+    log("Kör branch and bound.");
+
+    // Symmetric costs are needed for the bound
+    vector<int> cost(n * n), bound_cost(n * n);
+    for (int a = 0; a < n; a++) {
+        for (int b = 0; b < n; b++) {
+            cost[a * n + b] = dist(a, b);
+        }
+    }
+    for (int a = 0; a < n; a++) {
+        for (int b = 0; b < n; b++) {
+            bound_cost[a * n + b] = min(cost[a * n + b], cost[b * n + a]);
+        }
+    }
+
+    // Upper bound
+    compute_neighbour_list(n - 1);
+    two_opt_queue(n - 1, points);
+    vector<int> best_order = tour_order(points);
+    int best = total_dist();
+
+    // Closest points first
+    vector<vector<int>> closest(n);
+    for (int a = 0; a < n; a++) {
+        for (int b = 1; b < n; b++) {
+            if (a != b) closest[a].push_back(b);
+        }
+        sort(closest[a].begin(), closest[a].end(), [&](int x, int y) {
+            return cost[a * n + x] < cost[a * n + y];
+        });
+    }
+
+    vector<int> path(1, 0);
+    vector<bool> used(n, false);
+    used[0] = true;
+    vector<int> key(n);
+    long long nodes = 0;
+
+    // Minimum spanning tree of the unvisited points (Prim) plus edges to both ends.
+    // Every unvisited point also needs two edges, which gives a second bound as half
+    // the sum of the two cheapest edges of each point, the larger one is used.
+    auto bound = [&](int last) {
+        int total = 0, to_last = numeric_limits<int>::max(), to_start = numeric_limits<int>::max();
+        long long degrees = 0;
+        int first = -1;
+        for (int v = 1; v < n; v++) {
+            if (used[v]) continue;
+            key[v] = numeric_limits<int>::max();
+            to_last = min(to_last, bound_cost[last * n + v]);
+            to_start = min(to_start, bound_cost[v]);
+            if (first == -1) first = v;
+
+            int a = numeric_limits<int>::max(), b = numeric_limits<int>::max();
+            for (int w = 0; w < n; w++) {
+                if (w == v || (used[w] && w != last && w != 0)) continue;
+                int d = bound_cost[v * n + w];
+                if (d < a) {
+                    b = a;
+                    a = d;
+                } else if (d < b) {
+                    b = d;
+                }
+            }
+            degrees += (long long) a + b;
+        }
+        if (first == -1) return 0;
+        degrees += to_last + to_start;
+
+        key[first] = 0;
+        vector<bool> in_tree(used);
+        while (true) {
+            int u = -1;
+            for (int v = 1; v < n; v++) {
+                if (!in_tree[v] && (u == -1 || key[v] < key[u])) u = v;
+            }
+            if (u == -1) break;
+            in_tree[u] = true;
+            total += key[u];
+            for (int v = 1; v < n; v++) {
+                if (!in_tree[v] && bound_cost[u * n + v] < key[v]) key[v] = bound_cost[u * n + v];
+            }
+        }
+        return max(total + to_last + to_start, (int) ((degrees + 1) / 2));
+    };
+
+    // Stopping at the gap target proves nothing, just like running out of nodes
+    bool stopped = false;
+    function<void(int)> branch = [&](int length) {
+        if (++nodes > max_nodes) return;
+        if (reached_target(best)) {
+            stopped = true;
+            return;
+        }
+        int last = path.back();
+        if ((int) path.size() == n) {
+            if (length + cost[last * n] < best) {
+                best = length + cost[last * n];
+                best_order = path;
+            }
+            return;
+        }
+        if (length + bound(last) >= best) return;
+
+        for (int next : closest[last]) {
+            if (used[next] || length + cost[last * n + next] >= best) continue;
+            used[next] = true;
+            path.push_back(next);
+            branch(length + cost[last * n + next]);
+            path.pop_back();
+            used[next] = false;
+        }
+    };
+    branch(0);
+
+    set_tour(best_order, points);
+    return nodes <= max_nodes && !stopped;
+}
+
+// ########################################################################################
+// ########################################################################################
+// ####################### 2-OPT ##########################################################
+// ########################################################################################
+// ########################################################################################
+/**
+ * Improves a solution with 2-OPT
+ * @param  k_max maximum number of iterations
+ * @return       number of iterations
+ */
+int TSP::improve_two_opt(int k_max) {
+    log("Kör 2-opt (vanlig).");
+
+    // Set some initial state variables
+    srand(time(NULL));
+    int current_score = total_dist();
+    bool improvement = true;
+    int max_iter = k_max;
+    int iter = 0;
+
+    TourIndex index;
+
+    // Loop until no improvement can be made, but maximum max_iter times
+    for (; improvement && iter < max_iter; ++iter) { 
+        improvement = false;
+        int i = 0;
+        int iMax = 0, jMax = 0, valMax = 0;
+        if (!symmetric) {
+            index_tour(points, index);
+        }
+        // Loop and find the best move, then do the move after the loop
+        do {
+            int j = points[i].next;
+
+            // Find j's neighbours
+            while(j != 0 && !improvement) {
+                int swapCost = 0;
+
+                if (j == points[i].prev) {
+                    // We are swapping everythinng
+                    swapCost = 0;
+                } else if (j == points[i].next) {
+                    swapCost = swap_cost(i, j, points);
+                } else {
+                    swapCost = two_opt_swap_cost(i, j, points, index);
+                }
+                
+                if (swapCost < valMax) {
+                    // If we found new max, save it
+                    valMax = swapCost;
+                    iMax = i;
+                    jMax = j;
+                }
+
+                j = points[j].next;
+            }
+            i = points[i].next;
+        } while (i != 0 && !improvement);
+
+        // Perform max if it is good enough
         if (valMax < 0) {
             two_opt_swap(iMax, jMax, points);
             current_score += valMax;
-            improvement = true;
+            improvement = !reached_target(current_score);
         }
     }
     return iter;
@@ -488,7 +1737,7 @@ int TSP::improve_two_opt(int k_max) {
  * @return       number of iterations
  */
 void TSP::improve_two_opt_neighbour(int k_max, int m) {
-    cerr << "Kör 2-opt med grannlista." << endl;
+    log("Kör 2-opt med grannlista.");
 
     // Make sure m is smaller or equal to n-1, because we cant find other neighbours 
     m = m < n-1 ? m : n-1;
@@ -497,10 +1746,15 @@ void TSP::improve_two_opt_neighbour(int k_max, int m) {
     compute_neighbour_list(m);
 
     // Loop until no improvement can be made, but maximum max_iter times
-    bool improvement = true;
+    int current_score = total_dist();
+    bool improvement = !reached_target(current_score);
+    TourIndex index;
     for (int iter = 0; improvement && iter < k_max; ++iter) { 
         improvement = false; // Set to false to demand improvement until next lap in loop
         int i = 0, iMax = 0, jMax = 0, valMax = 0;
+        if (!symmetric) {
+            index_tour(points, index);
+        }
 
         // Loop through each node, and look at its neighbours
         do {
@@ -515,7 +1769,7 @@ void TSP::improve_two_opt_neighbour(int k_max, int m) {
                 } else if (j == points[i].next) {
                     cost = swap_cost(i, j, points);
                 } else {
-                    cost = two_opt_swap_cost(i, j, points);
+                    cost = two_opt_swap_cost(i, j, points, index);
                 }
 
                 if (cost < valMax) {
@@ -529,11 +1783,374 @@ void TSP::improve_two_opt_neighbour(int k_max, int m) {
 
         if (valMax < 0) {
             two_opt_swap(iMax, jMax, points);
-            improvement = true;
+            current_score += valMax;
+            improvement = !reached_target(current_score);
+        }
+    }
+}
+
+/**
+ * Improves the given tour with 2-OPT until no improving move is left, using the
+ * already computed neighbour list. Instead of searching for the best move every lap,
+ * points are kept in a queue and the first move that adds an edge to one of its
+ * neighbours and shortens the tour is taken. Only the endpoints of a move are queued
+ * again, so each move costs O(m) to find.
+ * @param m    maximum number of neighbours to look at
+ * @param list the tour to improve
+ */
+void TSP::two_opt_queue(int m, vector<Point>& list) {
+    deque<int> queue;
+    vector<bool> queued(n, true);
+    for (int i = 0; i < n; i++) {
+        queue.push_back(i);
+    }
+
+    while (!queue.empty()) {
+        int i = queue.front();
+        queue.pop_front();
+        queued[i] = false;
+
+        int count = min(m, (int) neighbours[i].size());
+        for (int x = 0; x < count; x++) {
+            int j = neighbours[i][x];
+
+            // Add the edge (i, j) by reversing either the path after i up to j,
+            // or the path from j up to before i
+            int a = -1, b = -1;
+            if (j != list[i].next && two_opt_swap_cost(list[i].next, j, list) < 0) {
+                a = list[i].next;
+                b = j;
+            } else if (j != list[i].prev && two_opt_swap_cost(j, list[i].prev, list) < 0) {
+                a = j;
+                b = list[i].prev;
+            }
+            if (a == -1) continue;
+
+            int touched[4] = { list[a].prev, a, b, list[b].next };
+            two_opt_swap(a, b, list);
+            for (int t : touched) {
+                if (!queued[t]) {
+                    queued[t] = true;
+                    queue.push_back(t);
+                }
+            }
+            break;
         }
     }
 }
 
+// ########################################################################################
+// ########################################################################################
+// ####################### Recombination ##################################################
+// ########################################################################################
+// ########################################################################################
+/**
+ * Returns the tour as a list of indices in visiting order, starting at 0.
+ * @param  list the tour
+ * @return      the visiting order
+ */
+vector<int> TSP::tour_order(const vector<Point>& list) const {
+    vector<int> order;
+    order.reserve(n);
+    int i = 0;
+    do {
+        order.push_back(i);
+        i = list[i].next;
+    } while (i != 0);
+    return order;
+}
+
+/**
+ * Links the points in the given list according to a visiting order.
+ * @param order the visiting order, containing every index once
+ * @param list  the list to relink
+ */
+void TSP::set_tour(const vector<int>& order, vector<Point>& list) const {
+    for (int i = 0; i < n; i++) {
+        list[order[i]].next = order[(i + 1) % n];
+        list[order[i]].prev = order[(i + n - 1) % n];
+    }
+}
+
+/**
+ * Perturbs the tour with a number of double bridge moves. Each move cuts the tour
+ * at three places within a short window and reconnects the segments as A C B D,
+ * which 2-opt cannot undo but which keeps the change local.
+ * @param list  the tour to perturb
+ * @param kicks number of double bridge moves
+ */
+void TSP::double_bridge(vector<Point>& list, int kicks) const {
+    vector<int> order = tour_order(list);
+    vector<int> next;
+    next.reserve(n);
+    int window = min(n, 30);
+
+    for (int k = 0; k < kicks; k++) {
+        // Three distinct cut points a < b < c after the start
+        int a, b, c;
+        do {
+            a = 1 + rand() % (window - 1);
+            b = 1 + rand() % (window - 1);
+            c = 1 + rand() % (window - 1);
+            if (a > b) std::swap(a, b);
+            if (b > c) std::swap(b, c);
+            if (a > b) std::swap(a, b);
+        } while (a == b || b == c);
+
+        int start = rand() % n;
+        next.clear();
+        for (int p = 0; p < a; p++) next.push_back(order[(start + p) % n]);
+        for (int p = b; p < c; p++) next.push_back(order[(start + p) % n]);
+        for (int p = a; p < b; p++) next.push_back(order[(start + p) % n]);
+        for (int p = c; p < n; p++) next.push_back(order[(start + p) % n]);
+        order.swap(next);
+    }
+
+    set_tour(order, list);
+}
+
+/**
+ * Builds a closest neighbour tour from the given start, using the neighbour list
+ * and falling back to scanning all points when every listed neighbour is used.
+ * @param start the point to start at
+ * @param list  the list to link the tour into
+ */
+void TSP::nearest_neighbour_tour(int start, vector<Point>& list) const {
+    vector<int> order;
+    order.reserve(n);
+    vector<bool> used(n, false);
+    int u = start;
+    used[u] = true;
+    order.push_back(u);
+
+    for (int i = 1; i < n; i++) {
+        int best = -1;
+        for (int j : neighbours[u]) {
+            if (!used[j]) {
+                best = j;
+                break;
+            }
+        }
+        if (best == -1) {
+            for (int j = 0; j < n; j++) {
+                if (!used[j] && (best == -1 || dist(u, j) < dist(u, best))) {
+                    best = j;
+                }
+            }
+        }
+        u = best;
+        used[u] = true;
+        order.push_back(u);
+    }
+
+    set_tour(order, list);
+}
+
+/**
+ * Partition crossover (GPX) of two tours. The edges that are not shared by both parents
+ * fall apart into components. A component that both parents visit as one contiguous path
+ * is entered and left through the same shared edges in both, so the child can take the
+ * path of either parent through it independently of the others. The cheaper path is taken
+ * for each such component, everything else is inherited from a.
+ * @param  a     the first parent, preferably the better one
+ * @param  b     the second parent
+ * @param  child the resulting tour
+ * @return       number of components taken from b
+ */
+int TSP::partition_crossover(const vector<Point>& a, const vector<Point>& b, vector<Point>& child) const {
+    // Union-find over the edges that are not shared
+    vector<int> parent(n);
+    for (int i = 0; i < n; i++) {
+        parent[i] = i;
+    }
+    auto find = [&](int x) {
+        while (parent[x] != x) {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
+        }
+        return x;
+    };
+
+    vector<bool> touched(n, false);
+    for (int u = 0; u < n; u++) {
+        int v = a[u].next;
+        if (b[u].next != v && b[u].prev != v) {
+            parent[find(u)] = find(v);
+            touched[u] = touched[v] = true;
+        }
+        v = b[u].next;
+        if (a[u].next != v && a[u].prev != v) {
+            parent[find(u)] = find(v);
+            touched[u] = touched[v] = true;
+        }
+    }
+
+    // Component of every point, -1 for points that only have shared edges
+    vector<int> component(n, -1);
+    for (int u = 0; u < n; u++) {
+        if (touched[u]) {
+            component[u] = find(u);
+        }
+    }
+
+    // Count how many times each parent leaves a component, and its cost inside it
+    vector<int> exits_a(n, 0), exits_b(n, 0), cost_a(n, 0), cost_b(n, 0);
+    for (int u = 0; u < n; u++) {
+        int r = component[u];
+        if (r == -1) continue;
+        if (component[a[u].next] != r) {
+            exits_a[r]++;
+        } else {
+            cost_a[r] += dist(u, a[u].next);
+        }
+        if (component[b[u].next] != r) {
+            exits_b[r]++;
+        } else {
+            cost_b[r] += dist(u, b[u].next);
+        }
+    }
+
+    vector<bool> take(n, false);
+    int taken = 0;
+    for (int r = 0; r < n; r++) {
+        if (exits_a[r] == 1 && exits_b[r] == 1 && cost_b[r] < cost_a[r]) {
+            take[r] = true;
+            taken++;
+        }
+    }
+
+    child = a;
+    if (taken == 0) {
+        return 0;
+    }
+
+    // Start where a enters a component, or outside of the taken ones
+    int start = 0;
+    while (component[start] != -1 && take[component[start]] &&
+            component[a[start].prev] == component[start]) {
+        start = a[start].next;
+    }
+
+    vector<int> order;
+    order.reserve(n);
+    int u = start;
+    while ((int) order.size() < n) {
+        int r = component[u];
+        if (r == -1 || !take[r]) {
+            order.push_back(u);
+            u = a[u].next;
+            continue;
+        }
+
+        // Follow b through the component, it ends where a leaves it
+        int prev = -1, w = u;
+        while (true) {
+            order.push_back(w);
+            int next = -1;
+            if (b[w].next != prev && component[b[w].next] == r) {
+                next = b[w].next;
+            } else if (b[w].prev != prev && component[b[w].prev] == r) {
+                next = b[w].prev;
+            }
+            if (next == -1) break;
+            prev = w;
+            w = next;
+        }
+        u = a[w].next;
+    }
+
+    set_tour(order, child);
+    return taken;
+}
+
+/**
+ * Improves the solution by recombining a population of local optima.
+ * The population is the current tour, perturbed copies of it and closest neighbour
+ * tours from random starts, all polished with 2-opt. The copies share most of their
+ * structure with the current tour, which suits uniform instances, while the new tours
+ * differ in how clusters are connected. Pairs are merged with partition crossover, and
+ * the offspring is polished and replaces the worst tour if it is better and not
+ * already in the population.
+ * @param population number of tours to keep
+ * @param generations number of crossovers
+ * @param m          maximum number of neighbours in neighbour list
+ */
+void TSP::improve_recombination(int population, int generations, int m) {
+    log("Kör rekombination.");
+
+    if (n < 8 || population < 2) {
+        return;
+    }
+
+    srand(time(NULL));
+    m = m < n-1 ? m : n-1;
+    compute_neighbour_list(m);
+
+    // New members alternate between perturbed copies of the best tour and closest neighbour tours
+    int kicks = max(1, n / 100);
+    vector<vector<Point>> pool;
+    vector<int> scores;
+    auto seed = [&](int p, vector<Point>& tour) {
+        if (p % 2 == 0) {
+            tour = pool[min_element(scores.begin(), scores.end()) - scores.begin()];
+            double_bridge(tour, kicks);
+        } else {
+            nearest_neighbour_tour(rand() % n, tour);
+        }
+        two_opt_queue(m, tour);
+    };
+
+    // Create the population
+    for (int p = 0; p < population; p++) {
+        vector<Point> tour(points);
+        if (p == 0) {
+            two_opt_queue(m, tour);
+        } else {
+            seed(p, tour);
+        }
+        scores.push_back(total_dist(tour));
+        pool.push_back(tour);
+    }
+
+    vector<Point> child;
+    for (int g = 0; g < generations; g++) {
+        if (reached_target(*min_element(scores.begin(), scores.end()))) break;
+
+        int x = rand() % population;
+        int y = rand() % population;
+        if (x == y) continue;
+        if (scores[y] < scores[x]) {
+            std::swap(x, y);
+        }
+
+        if (partition_crossover(pool[x], pool[y], child) == 0) {
+            // Nothing to gain from b, replace it with a new tour
+            seed(g, pool[y]);
+            scores[y] = total_dist(pool[y]);
+            continue;
+        }
+        two_opt_queue(m, child);
+        int score = total_dist(child);
+
+        // Replace the worst one, unless the child is a duplicate
+        int worst = 0;
+        bool duplicate = false;
+        for (int p = 0; p < population; p++) {
+            if (scores[p] > scores[worst]) worst = p;
+            if (scores[p] == score) duplicate = true;
+        }
+        if (!duplicate && score < scores[worst]) {
+            pool[worst] = child;
+            scores[worst] = score;
+        }
+    }
+
+    int best = min_element(scores.begin(), scores.end()) - scores.begin();
+    if (scores[best] < total_dist()) {
+        points = pool[best];
+    }
+}
+
 // ########################################################################################
 // ########################################################################################
 // ####################### Simulated annealing ############################################
@@ -544,7 +2161,7 @@ void TSP::improve_two_opt_neighbour(int k_max, int m) {
  * @param k_max the maximum number of iterations
  */
 void TSP::improve_simulated_annealing(int k_max) {
-    cerr << "Kör simulated annealing." << endl;
+    log("Kör simulated annealing.");
 
     // First seed the random generator with current time
     srand(time(NULL));
@@ -586,6 +2203,7 @@ void TSP::improve_simulated_annealing(int k_max) {
                 // If best ever
                 points = vector<Point>(current);
                 //cerr << "Found best ever! \t" << "Dist: " << total_dist() << endl;
+                if (reached_target(current_score)) break;
             }
         } else if (cost / t < (rand() % 100) / 100.0) { // TODO improve
             //cerr << "Accepted a worse solution by probability" << endl;
@@ -599,71 +2217,280 @@ void TSP::improve_simulated_annealing(int k_max) {
         }
     }
 
-    cerr << "Iter: " << iter << endl;
-    cerr << "T: " << t << endl;
+    if (verbose) {
+        cerr << "Iter: " << iter << endl;
+        cerr << "T: " << t << endl;
+    }
 }
 
 /**
- * An improved version of simulated annealing.
+ * Simulated annealing with moves drawn from the neighbour list. Every iteration picks a
+ * point i and one of its candidates j, and either adds the edge (i, j) with a 2-opt move
+ * or moves the path of one to three points starting at i next to j (Or-opt). A 2-opt
+ * move reverses whichever side of the tour is shorter and is skipped when both are
+ * longer than max_reversal, so no move costs more than that. The temperature falls
+ * geometrically from 50% to 1% of the mean distance to the closest neighbour, and the
+ * best tour is saved every n iterations.
  * @param k_max maximum number of iterations
  * @param m     maximum number of neighbours in list
  */
 void TSP::improve_v2_simulated_annealing(int k_max, int m) {
-    // First seed the random generator with current time
-    srand(time(NULL));
+    log("Kör simulated annealing med grannlista.");
 
-    int naive_score = total_dist();
+    if (n < 8) {
+        return;
+    }
 
-    // Set start values for variables
-    double t_max = naive_score * 0.9; // TODO improve
-    double t     = t_max; // TODO improve
+    m = m < n-1 ? m : n-1;
+    compute_neighbour_list(m);
+
+    const int max_reversal = 1000;
+
+    // Scale by the distance to the closest neighbour, which long jumps between clusters do not skew
+    double edge = 0;
+    for (int i = 0; i < n; i++) {
+        edge += dist(i, neighbours[i][0]);
+    }
+    edge /= n;
+    if (edge == 0) {
+        return;
+    }
+    double t_min = edge * 0.01, t_max = edge * 0.5;
+    double cooling = pow(t_min / t_max, 1.0 / k_max);
+    double t = t_max;
+
+    mt19937 rng(time(NULL));
+    uniform_real_distribution<double> uniform(0.0, 1.0);
 
     vector<Point> current(points);
-    int current_score = total_dist(current);
+    int current_score = total_dist();
+    int best_score = current_score;
+    const int interval = max(100, n);
 
-    // Do the annealing
     for (int k = 0; k < k_max; k++) {
-        // Decrease the temperature according to out formula
-        t -= t * (10.0 / k_max);
+        t *= cooling;
+
+        int i = rng() % n;
+        int j = neighbours[i][rng() % neighbours[i].size()];
+
+        if (rng() % 2 == 0) {
+            // Add the edge (i, j) by reversing the path after i or before i
+            int a, b;
+            if (rng() % 2 == 0) {
+                if (j == current[i].next) continue;
+                a = current[i].next;
+                b = j;
+            } else {
+                if (j == current[i].prev) continue;
+                a = j;
+                b = current[i].prev;
+            }
 
-        // Change two random entries
-        int r1 = rand() % n;
-        int r2 = rand() % n;
-        if (neighbours[r1].size() != 0) {
-            r2 = rand() % neighbours[r1].size();
-            r2 = neighbours[r1][r2];
-        }
+            // An asymmetric cost depends on the side that is reversed, so it is found after the walk
+            int cost = symmetric ? two_opt_swap_cost(a, b, current) : 0;
+            if (cost > 0 && uniform(rng) >= exp(-cost / t)) continue;
+
+            // Walk both sides at once, reversing the rest of the tour gives the same tour
+            int x = a, y = current[b].next, end = current[a].prev;
+            if (y == end) continue;
+            int steps = 0;
+            while (x != b && y != end && steps < max_reversal) {
+                x = current[x].next;
+                y = current[y].next;
+                steps++;
+            }
+            if (y == end && x != b) {
+                a = current[b].next;
+                b = end;
+            } else if (x != b) {
+                continue;
+            }
+            if (!symmetric) {
+                cost = two_opt_swap_cost(a, b, current);
+                if (cost > 0 && uniform(rng) >= exp(-cost / t)) continue;
+            }
+            two_opt_swap(a, b, current);
+            current_score += cost;
+        } else {
+            // Move the path starting at i in between j and one of its tour neighbours
+            int len = 1 + rng() % 3;
+            int e = i;
+            bool valid = e != j;
+            for (int s = 1; s < len && valid; s++) {
+                e = current[e].next;
+                valid = e != j;
+            }
+            int a = rng() % 2 == 0 ? j : current[j].prev;
+            if (!valid || a == current[i].prev || a == e) continue;
 
-        int cost = swap_cost(r1, r2, current);
-        int twooptCost = cost + 1;
-        if (r2 != current[r1].prev && r2 != current[r1].next) {
-            twooptCost = two_opt_swap_cost(r1, r2, current);
+            int forward = or_opt_swap_cost(i, e, a, false, current);
+            int reversed = or_opt_swap_cost(i, e, a, true, current);
+            int cost = min(forward, reversed);
+            if (cost > 0 && uniform(rng) >= exp(-cost / t)) continue;
 
+            or_opt_swap(i, e, a, reversed < forward, current);
+            current_score += cost;
         }
 
-        if (cost <= 0 || twooptCost <= 0) {
-            // This solution is better than what we have, go for it!
-            if (cost < twooptCost) {
-                swap(r1, r2, current);
-            } else {
-                two_opt_swap(r1, r2, current);
-                cost =  twooptCost;
+        // The whole tour is measured now and then, so that a misjudged move can not make it worse
+        if ((k + 1) % interval == 0 && current_score < best_score) {
+            current_score = total_dist(current);
+            if (current_score < best_score) {
+                points = current;
+                best_score = current_score;
+                if (reached_target(best_score)) break;
             }
-            current_score += cost;
+        }
+    }
 
+    if (total_dist(current) < best_score) {
+        points = current;
+    }
+}
+
+// ########################################################################################
+// ########################################################################################
+// ####################### Parallel tempering #############################################
+// ########################################################################################
+// ########################################################################################
+/**
+ * State of one replica in parallel tempering.
+ */
+struct Replica {
+    vector<Point> tour;
+    int score;
+    vector<Point> best;
+    int best_score;
 
+    // Epoch the replica has finished, and epoch its partner has released it from
+    atomic<int> arrived;
+    atomic<int> released;
+};
 
-            if (current_score < total_dist()) {
-                // If best ever
-                points = vector<Point>(current);
+/**
+ * Performs simulated annealing on a ladder of temperatures in parallel, one thread per replica.
+ * Every replica runs 2-opt moves drawn from the neighbour list at its own fixed temperature.
+ * After each epoch neighbouring replicas, alternating between even and odd pairs, may exchange
+ * tours with the usual Metropolis criterion, so good tours sink to the cold end and bad ones
+ * get a chance to escape at the warm end. The pairs meet through atomic counters only: the
+ * lower replica waits for its partner to arrive, decides and swaps the tours, and releases it.
+ * The ladder is scaled by the mean edge length of the current tour, so no temperature has to
+ * be picked by hand.
+ * @param replicas number of replicas, 0 for one per hardware thread but at least 4
+ * @param k_max    number of iterations per replica
+ * @param m        maximum number of neighbours in neighbour list
+ */
+void TSP::improve_parallel_tempering(int replicas, int k_max, int m) {
+    log("Kör parallel tempering.");
+
+    if (replicas <= 0) {
+        replicas = max(4, (int) thread::hardware_concurrency());
+    }
+    if (n < 8 || replicas < 2) {
+        return;
+    }
+
+    m = m < n-1 ? m : n-1;
+    compute_neighbour_list(m);
+
+    // Geometric ladder between 1% and 20% of the mean edge length
+    double edge = (double) total_dist() / n;
+    double t_min = edge * 0.01, t_max = edge * 0.2;
+    vector<double> temperature(replicas);
+    for (int r = 0; r < replicas; r++) {
+        temperature[r] = t_min * pow(t_max / t_min, (double) r / (replicas - 1));
+    }
+
+    vector<Replica> state(replicas);
+    for (Replica & s : state) {
+        s.tour = points;
+        s.score = total_dist();
+        s.best = points;
+        s.best_score = s.score;
+        s.arrived = 0;
+        s.released = 0;
+    }
+
+    const int interval = max(100, n);
+    const int epochs = max(1, k_max / interval);
+    unsigned int seed = time(NULL);
+
+    // Set when a replica reaches the target, the others then only take part in the exchanges
+    atomic<bool> done(reached_target(total_dist()));
+
+    auto run = [&](int r) {
+        mt19937 rng(seed + 7919 * r);
+        uniform_real_distribution<double> uniform(0.0, 1.0);
+        const double t = temperature[r];
+
+        for (int e = 0; e < epochs; e++) {
+            Replica & s = state[r];
+            vector<Point> & tour = s.tour;
+
+            for (int k = 0; k < interval && !done.load(memory_order_relaxed); k++) {
+                int i = rng() % n;
+                int j = neighbours[i][rng() % neighbours[i].size()];
+
+                // Add the edge (i, j) by reversing the path after i or before i
+                int a, b;
+                if (rng() % 2 == 0) {
+                    if (j == tour[i].next) continue;
+                    a = tour[i].next;
+                    b = j;
+                } else {
+                    if (j == tour[i].prev) continue;
+                    a = j;
+                    b = tour[i].prev;
+                }
+
+                int cost = two_opt_swap_cost(a, b, tour);
+                if (cost <= 0 || uniform(rng) < exp(-cost / t)) {
+                    two_opt_swap(a, b, tour);
+                    s.score += cost;
+                }
             }
-        } else if (cost / t < (rand() % 100) / 100.0) {
-            // The neighbor solution, copy of the one we have
 
-            swap(r1, r2, current);
+            if (s.score < s.best_score) {
+                s.best = s.tour;
+                s.best_score = s.score;
+                if (reached_target(s.best_score)) {
+                    done.store(true, memory_order_relaxed);
+                }
+            }
 
-            current_score += cost;
+            // Pairs are (r, r+1) where r has the same parity as the epoch
+            s.arrived.store(e + 1, memory_order_release);
+            if (r % 2 == e % 2 && r + 1 < replicas) {
+                Replica & other = state[r + 1];
+                while (other.arrived.load(memory_order_acquire) < e + 1) {
+                    this_thread::yield();
+                }
+
+                double delta = (1 / t - 1 / temperature[r + 1]) * (s.score - other.score);
+                if (delta >= 0 || uniform(rng) < exp(delta)) {
+                    s.tour.swap(other.tour);
+                    std::swap(s.score, other.score);
+                }
+                other.released.store(e + 1, memory_order_release);
+            } else if (r % 2 != e % 2 && r > 0) {
+                while (s.released.load(memory_order_acquire) < e + 1) {
+                    this_thread::yield();
+                }
+            }
         }
+    };
+
+    vector<thread> threads;
+    for (int r = 0; r < replicas; r++) {
+        threads.push_back(thread(run, r));
+    }
+    for (thread & th : threads) {
+        th.join();
+    }
 
+    for (Replica & s : state) {
+        if (s.best_score < total_dist() && total_dist(s.best) < total_dist()) {
+            points = s.best;
+        }
     }
 }
\ No newline at end of file
@@ -4,6 +4,9 @@
 #include <vector>
 #include <list>
 #include <string>
+#include <cstddef>
+#include <iostream>
+#include <cmath>
 using namespace std;
 
 /**
@@ -37,6 +40,27 @@ struct Edge {
     }
 };
 
+/**
+ * Cheap features of an instance, used to pick parameters automatically.
+ */
+struct Features {
+    int n;
+    // Mean distance between two points
+    double spread;
+    // 0 for uniformly spread points, approaching 1 the more clustered they are
+    double clustering;
+};
+
+/**
+ * Position of every point along a tour, and prefix sums of how much longer its edges get
+ * when they are walked backwards. Gives the cost of reversing a path on an asymmetric
+ * distance matrix in constant time, for as long as the tour is not changed.
+ */
+struct TourIndex {
+    vector<int> position;
+    vector<int> reversal;
+};
+
 /**
  * The main TSP class.
  */
@@ -48,25 +72,87 @@ class TSP {
         // Stores all neighbours to point i in [i]
         vector<vector<int>> neighbours;
 
+        // All edges, kept between instances of up to about 1500 points so that the space is reused
+        vector<Edge> edges;
+
         // Number of points
         int n;
 
         // Longest distance
         int longest_distance = 0;
 
+        // Node penalties from the lower bound, empty until it is computed
+        vector<double> penalty;
+
+        // Length at which the improving algorithms stop, -1 for never
+        int target_length = -1;
+
+        // Whether neighbour lists are ordered by alpha-nearness once penalties exist
+        bool alpha_nearness = false;
+
+        // Whether the algorithms log what they are doing to stderr
+        bool verbose = true;
+
+        // Memory-mapped distance matrix (n*n ints, row-major), nullptr when using coordinates
+        const int* matrix = nullptr;
+        size_t matrix_bytes = 0;
+
+        // Whether dist(a, b) == dist(b, a), only false for some distance matrices. For a
+        // matrix it is assumed false until compute_neighbour_list has checked it
+        bool symmetric = true;
+        bool symmetry_known = true;
+
     public:
         // Creates a new TSP problem
         TSP() : n(0) {};
 
+        // Unmaps the distance matrix if one is loaded
+        ~TSP();
+
+        // The mapping is owned by the instance, so it must not be copied
+        TSP(const TSP&) = delete;
+        TSP& operator=(const TSP&) = delete;
+
         // Adds a point to the world we know
         void add_point(double, double);
 
+        // Removes all points but keeps the buffers, for solving the next instance
+        void clear();
+
+        // Maps an explicit distance matrix from a binary file, returns false on failure
+        bool load_distance_matrix(const char* path);
+
+        // Number of points in the problem
+        int size() const { return n; }
+
         // Computes the neighbour list
         // Must be called before calling shortest edge
         void compute_neighbour_list(int m);
+        void compute_alpha_neighbour_list(int m);
+
+        // Held-Karp lower bound with the 1-tree relaxation
+        double lower_bound(int iterations, int m);
+        double one_tree(const vector<vector<int>>& graph, vector<int>& degree, vector<int>& parent) const;
+        double penalized_dist(int a, int b) const;
+        vector<vector<int>> penalty_clusters(const vector<int>& parent, vector<double>& gap) const;
+
+        // Early termination when the tour is close enough to the lower bound
+        void set_gap_target(double bound, double gap);
+        bool reached_target(int length) const { return length <= target_length; }
+
+        // Orders the neighbour lists by alpha-nearness after the lower bound is computed
+        void set_alpha_nearness(bool enabled) { alpha_nearness = enabled; }
+
+        // Estimates the features of the instance from a sample of the points
+        Features features(int samples) const;
 
         // Various prining functions
         void print_result() const;
+        void print_result(ostream& out) const;
+
+        // Logs a message to stderr unless logging is turned off
+        void log(const string& message) const { if (verbose) cerr << message << endl; }
+        void set_verbose(bool enabled) { verbose = enabled; }
         
         // Calculates total distance for whole path
         int total_dist() const;
@@ -74,34 +160,82 @@ class TSP {
         // Calculates total distance for the given list
         int total_dist(const vector<Point>& a) const;
 
+        // Reverses the tour if that makes it shorter
+        void orient_tour();
+
         // Calculates total disance between two indices in point list
         int dist(int, int) const;
         
         // Calculates costs for swapping a to b
         int swap_cost(const int a, const int b, const vector<Point>& list) const;
         int two_opt_swap_cost(const int a, const int b, const vector<Point>& list) const;
+        int two_opt_swap_cost(int a, int b, const vector<Point>& list, const TourIndex& index) const;
+        int or_opt_swap_cost(int f, int e, int a, bool reversed, const vector<Point>& list) const;
+        int reversal_cost(int a, int b, const vector<Point>& list) const;
+        void index_tour(const vector<Point>& list, TourIndex& index) const;
 
         // Performs swaps between a and b in given lists
         void swap(int a, int b, vector<Point>& list);
         void two_opt_swap(int i, int j, vector<Point>& list);
+        void or_opt_swap(int f, int e, int a, bool reversed, vector<Point>& list);
         
         // Returns true if edge will make list cyclic
         int is_cyclic(list<Edge> &, Edge) const;
 
+        // Converts between linked list and visiting order
+        vector<int> tour_order(const vector<Point>& list) const;
+        void set_tour(const vector<int>& order, vector<Point>& list) const;
+
+        // Perturbs a tour with local double bridge moves
+        void double_bridge(vector<Point>& list, int kicks) const;
+
+        // Builds a closest neighbour tour from start using the neighbour list
+        void nearest_neighbour_tour(int start, vector<Point>& list) const;
+
+        // Merges two tours with partition crossover
+        int partition_crossover(const vector<Point>& a, const vector<Point>& b, vector<Point>& child) const;
+
         // Our tour-finding algorithms
         void exec_shortest_edge();
         void exec_naive();
+        void exec_savings(int m);
+        void exec_multilevel(int m);
+
+        // Our exact algorithms, for small n
+        void exec_held_karp();
+        bool improve_branch_and_bound(long long max_nodes);
 
         // Our improving algorithms
         void improve_simulated_annealing(int k_max);
         void improve_v2_simulated_annealing(int k_max, int m);
         int  improve_two_opt(int k_max);
         void improve_two_opt_neighbour(int k_max, int m);
+        void two_opt_queue(int m, vector<Point>& list);
+        void improve_recombination(int population, int generations, int m);
+        void improve_parallel_tempering(int replicas, int k_max, int m);
+        void refine_level(const vector<int>& active, const vector<vector<int>>& near, int m, vector<Point>& list);
 
         // Heals the list
         void heal_list() {
+            if (points.empty()) return;
             points[points.size() - 1].next = 0;
             points[0].prev = n-1;
         };
 };
+
+/**
+ * Returns the euclidian distance between the two points a and b,
+ * or the entry from the distance matrix if one is loaded.
+ * Defined here so that it is inlined into the inner loops.
+ * @param  a point
+ * @param  b point
+ * @return   a euclidian distance rounded to integer
+ */
+inline int TSP::dist(int a, int b) const {
+    if (matrix == nullptr) {
+        return (int) (sqrt((points[a].x-points[b].x)*(points[a].x-points[b].x) + (points[a].y-points[b].y)*(points[a].y-points[b].y)) + 0.5);
+    }
+    return matrix[(size_t) a * n + b];
+}
+
 #endif
\ No newline at end of file